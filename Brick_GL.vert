@@ -0,0 +1,34 @@
+#version 330 core
+
+// input data : unit quad shared by every brick
+layout (location = 0) in vec2 vertexPosition;
+
+// input data : one per brick instance
+layout (location = 2) in vec2 brickCentre;
+layout (location = 3) in float brickSize;
+layout (location = 4) in vec4 brickColor;
+
+// camera of the frame, shared with the other programs
+layout (std140) uniform Camera
+{
+    mat4 layerVP[8];    // projection * view * zoom and pan of each layer
+};
+
+uniform int layer;      // layer the bricks are drawn in
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec2 fragShape;
+flat out vec2 fragRadius;
+
+void main ()
+{
+    // Scale the unit quad to the brick and move it to the brick centre
+    vec4 v = vec4(vertexPosition*brickSize + brickCentre, 0, 1);
+
+    fragColor = brickColor.rgb;
+    fragShape = vec2(0, 0);     // bricks are flat
+    fragRadius = vec2(0, 0);
+
+    gl_Position = layerVP[layer] * v;
+}
@@ -0,0 +1,41 @@
+#version 330 core
+
+// input data : all seven segments of a digit, shared by every digit
+layout (location = 0) in vec2 segmentUnit;     // in digit widths and heights from the centre
+layout (location = 1) in vec2 segmentAcross;   // thickness, in world units
+layout (location = 2) in uint segmentIndex;
+
+// input data : one per digit instance
+layout (location = 3) in vec4 digitBox;        // centre x, y, width, height
+layout (location = 4) in uint digitMask;       // lit segments, one bit each
+layout (location = 5) in vec4 digitColor;
+
+// camera of the frame, shared with the other programs
+layout (std140) uniform Camera
+{
+    mat4 layerVP[8];    // projection * view * zoom and pan of each layer
+};
+
+uniform int layer;      // layer the digits are drawn in
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec2 fragShape;
+flat out vec2 fragRadius;
+
+void main ()
+{
+    fragColor = digitColor.rgb;
+    fragShape = vec2(0, 0);     // segments are flat
+    fragRadius = vec2(0, 0);
+
+    // Segments that are off are moved out of clip space and never rasterized
+    if(((digitMask >> segmentIndex) & 1u) == 0u)
+    {
+        gl_Position = vec4(2, 2, 2, 1);
+        return;
+    }
+
+    vec2 p = digitBox.xy + segmentUnit*digitBox.zw + segmentAcross;
+    gl_Position = layerVP[layer] * vec4(p, 0, 1);
+}
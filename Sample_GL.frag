@@ -2,13 +2,29 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+in vec2 fragShape;          // position in a round shape
+flat in vec2 fragRadius;    // outer and inner radius, 0 for flat shapes
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
+    // Signed distance to the rim of a round shape, antialiased over one
+    // pixel. Flat shapes have no rim and stay opaque
+    float d = length(fragShape);
+    float w = max(fwidth(d), 1e-6);
+    float alpha = 1.0;
+    if(fragRadius.x > 0.0)
+    {
+        alpha = clamp((fragRadius.x - d)/w + 0.5, 0.0, 1.0);
+        if(fragRadius.y > 0.0)
+            alpha *= clamp((d - fragRadius.y)/w + 0.5, 0.0, 1.0);
+        if(alpha == 0.0)
+            discard;
+    }
+
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    color = vec4(fragColor, alpha);
 }
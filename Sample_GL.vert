@@ -1,22 +1,45 @@
 #version 330 core
 
 // input data : sent from main program
-layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexColor;
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec4 vertexColor;
+layout (location = 2) in uint spriteIndex;
+layout (location = 3) in vec2 vertexShape;     // position in a round shape
+layout (location = 4) in vec2 vertexRadius;    // outer and inner radius, 0 for flat shapes
 
-uniform mat4 MVP;
+// camera of the frame, shared with the other programs
+layout (std140) uniform Camera
+{
+    mat4 layerVP[8];    // projection * view * zoom and pan of each layer
+};
+
+// placement of every sprite in the batch : x, y, angle in radians, layer
+layout (std140) uniform Sprites
+{
+    vec4 placement[256];
+};
 
 // output data : used by fragment shader
 out vec3 fragColor;
+out vec2 fragShape;
+flat out vec2 fragRadius;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec4 sprite = placement[spriteIndex];
+
+    // Rotate the vertex about the sprite origin, then move it into place
+    float c = cos(sprite.z);
+    float s = sin(sprite.z);
+    vec2 p = vec2(c*vertexPosition.x - s*vertexPosition.y, s*vertexPosition.x + c*vertexPosition.y);
+    vec4 v = vec4(p + sprite.xy, 0, 1); // Transform an homogeneous 4D vector in the z=0 plane
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = vertexColor.rgb;
+    fragShape = vertexShape;
+    fragRadius = vertexRadius;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space
+    gl_Position = layerVP[int(sprite.w)] * v;
 }
@@ -0,0 +1,29 @@
+#version 330 core
+
+// input data : vertices of static sprites, already placed in the world
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec4 vertexColor;
+layout (location = 3) in vec2 vertexShape;     // position in a round shape
+layout (location = 4) in vec2 vertexRadius;    // outer and inner radius, 0 for flat shapes
+
+// camera of the frame, shared with the other programs
+layout (std140) uniform Camera
+{
+    mat4 layerVP[8];    // projection * view * zoom and pan of each layer
+};
+
+uniform int layer;      // layer the vertices are drawn in
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec2 fragShape;
+flat out vec2 fragRadius;
+
+void main ()
+{
+    fragColor = vertexColor.rgb;
+    fragShape = vertexShape;
+    fragRadius = vertexRadius;
+
+    gl_Position = layerVP[layer] * vec4(vertexPosition, 0, 1);
+}
@@ -2,12 +2,24 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
-#include<map>
+#include <map>
+#include <chrono>
+#include <type_traits>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
 #include<string>
 #include<stdlib.h>
 
 #include <glad/glad.h>
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+typedef struct GLFWwindow GLFWwindow;   // always NULL, there is no window
+#else
 #include <GLFW/glfw3.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -16,22 +28,88 @@
 
 using namespace std;
 
+#ifdef ALLOC_CHECK
+/* Count every heap allocation so the main loop can prove that frames
+   after warm-up never touch the allocator */
+long allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if(!p)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept
+{
+    free(p);
+}
+
+long allocmark()
+{
+    return allocations;
+}
+
+/* Abort if anything was allocated since 'mark' */
+void allocassert(long mark, const char* where)
+{
+    if(allocations != mark)
+    {
+        cerr<<allocations-mark<<" heap allocation(s) in "<<where<<endl;
+        exit(EXIT_FAILURE);
+    }
+}
+#else
+long allocmark()
+{
+    return 0;
+}
+
+void allocassert(long mark, const char* where)
+{
+}
+#endif
+
+/* Vertex layout of every mesh: 2D position, a normalized RGBA8 colour and,
+   for round shapes, where the vertex lies in the shape, interleaved in one
+   buffer. Flat meshes leave the shape fields at zero */
+typedef struct Vertex2D
+{
+    GLfloat x, y;
+    GLubyte rgba[4];
+    GLbyte u, v;            // position in a round shape, -127..127 edge to edge
+    GLubyte outer, inner;   // radii of the shape in the same units, 0..255; outer 0 for flat meshes
+} Vertex2D;
+
 struct VAO {
     GLuint VertexArrayID;
-    GLuint VertexBuffer;
-    GLuint ColorBuffer;
+    GLuint VertexBuffer;    // interleaved Vertex2D
 
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+    GLuint IndexBuffer;     // 0 when drawn without indices
+    int NumIndices;
+    int RefCount;
+    GLfloat Bounds[4];      // x0, y0, x1, y1 of the vertices, about the origin
+    GLfloat Radius;         // distance of the farthest vertex from the origin
+
+    // CPU copy of the geometry, read by the sprite batch
+    vector<Vertex2D> Vertices;
+    vector<GLushort> Indices;
 };
 typedef struct VAO VAO;
 
 struct GLMatrices {
     glm::mat4 projection;
-    glm::mat4 model;
     glm::mat4 view;
-    GLuint MatrixID;
 } Matrices;
 
 GLuint programID;
@@ -107,159 +185,2006 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 //    fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
 
-    glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+    glDeleteShader(VertexShaderID);
+    glDeleteShader(FragmentShaderID);
+
+    return ProgramID;
+}
+
+#ifndef HEADLESS
+static void error_callback(int error, const char* description)
+{
+    fprintf(stderr, "Error: %s\n", description);
+}
+
+void quit(GLFWwindow *window)
+{
+    // main() releases the GL objects and destroys the window once the loop ends
+    glfwSetWindowShouldClose(window, GL_TRUE);
+    cout<<endl;
+    cout<<"Why you close game? :( "<<endl;
+    cout<<endl;
+    cout<<endl;
+    //    exit(EXIT_SUCCESS);
+}
+#endif
+
+
+/* Live GL objects owned by the game and the bytes sent to them */
+typedef struct GLStats
+{
+    int vertexarrays;
+    int buffers;
+    int programs;
+    int textures;
+    int framebuffers;
+    long bufferbytes;       // held by live buffers right now
+    long uploadedbytes;     // sent to buffers since startup
+}GLStats;
+
+/* GL state changes asked for, and how many of them were dropped because
+   the state was already set */
+typedef struct GLStateStats
+{
+    long issued;
+    long skipped;
+}GLStateStats;
+
+/* Remembers the GL state the frame sets over and over: program, VAO,
+   array buffer, uniform block ranges and polygon mode. A call that would
+   not change anything is counted and dropped. Built with -DGL_STATE_CHECK
+   every call first compares the cache with what GL reports */
+class GLState
+{
+    public:
+        GLState() : counts()
+        {
+            invalidate();
+        }
+        void useProgram(GLuint id)
+        {
+            verify();
+            if(changed(program, id))
+                glUseProgram(id);
+        }
+        void bindVertexArray(GLuint id)
+        {
+            verify();
+            if(changed(vertexarray, id))
+                glBindVertexArray(id);
+        }
+        void bindBuffer(GLenum target, GLuint id)
+        {
+            verify();
+            if(target!=GL_ARRAY_BUFFER)     // the element array binding belongs to the VAO
+                glBindBuffer(target, id);
+            else if(changed(arraybuffer, id))
+                glBindBuffer(target, id);
+        }
+        void bindUniformRange(GLuint index, GLuint id, GLintptr offset, GLsizeiptr size)
+        {
+            verify();
+            UniformRange r = {id, offset, size};
+            if(index>=uniformblocks)
+            {
+                glBindBufferRange(GL_UNIFORM_BUFFER, index, id, offset, size);
+                return;
+            }
+            UniformRange& cached = uniforms[index];
+            if(cached.buffer==r.buffer && cached.offset==r.offset && cached.size==r.size)
+            {
+                counts.skipped++;
+                return;
+            }
+            glBindBufferRange(GL_UNIFORM_BUFFER, index, id, offset, size);
+            cached = r;
+            counts.issued++;
+        }
+        void polygonMode(GLenum mode)
+        {
+            verify();
+            if(changed(polygonmode, mode))
+                glPolygonMode(GL_FRONT_AND_BACK, mode);
+        }
+        /* Deleting a bound object unbinds it */
+        void forgetBuffer(GLuint id)
+        {
+            if(arraybuffer==id)
+                arraybuffer = 0;
+            for(int i=0;i<uniformblocks;i++)
+                if(uniforms[i].buffer==id)
+                    uniforms[i].buffer = UNKNOWN;
+        }
+        void forgetVertexArray(GLuint id)
+        {
+            if(vertexarray==id)
+                vertexarray = 0;
+        }
+        void forgetProgram(GLuint id)
+        {
+            if(program==id)
+                program = UNKNOWN;
+        }
+        /* Set everything again on next use, after GL state was changed
+           behind the cache */
+        void invalidate()
+        {
+            program = vertexarray = arraybuffer = polygonmode = UNKNOWN;
+            for(int i=0;i<uniformblocks;i++)
+                uniforms[i].buffer = UNKNOWN;
+        }
+        GLStateStats stats() const
+        {
+            return counts;
+        }
+        /* Abort if the cache and GL disagree. Does nothing unless built
+           with -DGL_STATE_CHECK */
+        void verify() const
+        {
+#ifdef GL_STATE_CHECK
+            GLint v[2];
+            glGetIntegerv(GL_CURRENT_PROGRAM, v);
+            expect(program, v[0], "program");
+            glGetIntegerv(GL_VERTEX_ARRAY_BINDING, v);
+            expect(vertexarray, v[0], "vertex array");
+            glGetIntegerv(GL_ARRAY_BUFFER_BINDING, v);
+            expect(arraybuffer, v[0], "array buffer");
+            glGetIntegerv(GL_POLYGON_MODE, v);
+            expect(polygonmode, v[0], "polygon mode");
+            for(int i=0;i<uniformblocks;i++)
+            {
+                if(uniforms[i].buffer==UNKNOWN)
+                    continue;
+                GLint64 start, size;
+                glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, i, v);
+                glGetInteger64i_v(GL_UNIFORM_BUFFER_START, i, &start);
+                glGetInteger64i_v(GL_UNIFORM_BUFFER_SIZE, i, &size);
+                expect(uniforms[i].buffer, v[0], "uniform buffer");
+                if(start!=uniforms[i].offset || size!=uniforms[i].size)
+                    expect(0, 1, "uniform buffer range");
+            }
+#endif
+        }
+    private:
+        static const GLuint UNKNOWN = ~0u;     // never set through the cache
+        static const int uniformblocks = 4;
+        typedef struct UniformRange
+        {
+            GLuint buffer;
+            GLintptr offset;
+            GLsizeiptr size;
+        }UniformRange;
+
+        /* Store 'value' in 'cached' and tell whether it differed */
+        bool changed(GLuint& cached, GLuint value)
+        {
+            if(cached==value)
+            {
+                counts.skipped++;
+                return false;
+            }
+            cached = value;
+            counts.issued++;
+            return true;
+        }
+        static void expect(GLuint cached, GLint actual, const char* what)
+        {
+            if(cached!=UNKNOWN && cached!=(GLuint)actual)
+            {
+                cerr<<"GL state cache out of date: "<<what<<" is "<<actual<<", cached "<<cached<<endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        GLuint program;
+        GLuint vertexarray;
+        GLuint arraybuffer;
+        GLuint polygonmode;
+        UniformRange uniforms[uniformblocks];
+        GLStateStats counts;
+};
+
+GLState glstate;
+
+/* Every GL object the game creates goes through here, so the number of
+   live objects and the bytes they hold can be checked at any time */
+class GLResources
+{
+    public:
+        GLResources() : live()
+        {
+        }
+        GLuint createVertexArray()
+        {
+            GLuint id;
+            glGenVertexArrays(1, &id);
+            live.vertexarrays++;
+            return id;
+        }
+        void deleteVertexArray(GLuint id)
+        {
+            glDeleteVertexArrays(1, &id);
+            glstate.forgetVertexArray(id);
+            live.vertexarrays--;
+        }
+        GLuint createBuffer(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+        {
+            GLuint id;
+            glGenBuffers(1, &id);
+            glstate.bindBuffer(target, id);
+            glBufferData(target, size, data, usage);
+            buffersizes[id] = size;
+            live.buffers++;
+            live.bufferbytes += size;
+            live.uploadedbytes += size;
+            return id;
+        }
+        void updateBuffer(GLenum target, GLuint id, GLintptr offset, GLsizeiptr size, const void* data)
+        {
+            glstate.bindBuffer(target, id);
+            glBufferSubData(target, offset, size, data);
+            live.uploadedbytes += size;
+        }
+        void uploaded(GLsizeiptr size)    // data written through a mapping
+        {
+            live.uploadedbytes += size;
+        }
+        void deleteBuffer(GLuint id)
+        {
+            glDeleteBuffers(1, &id);
+            glstate.forgetBuffer(id);
+            live.buffers--;
+            live.bufferbytes -= buffersizes[id];
+            buffersizes.erase(id);
+        }
+        GLuint createProgram(const char* vertex_file_path, const char* fragment_file_path)
+        {
+            live.programs++;
+            return LoadShaders(vertex_file_path, fragment_file_path);
+        }
+        void deleteProgram(GLuint id)
+        {
+            glDeleteProgram(id);
+            glstate.forgetProgram(id);
+            live.programs--;
+        }
+        /* An RGBA8 render target of width x height, read back texel for texel */
+        GLuint createTexture(int width, int height)
+        {
+            GLuint id;
+            glGenTextures(1, &id);
+            glBindTexture(GL_TEXTURE_2D, id);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            live.textures++;
+            return id;
+        }
+        void deleteTexture(GLuint id)
+        {
+            glDeleteTextures(1, &id);
+            live.textures--;
+        }
+        /* A framebuffer drawing into 'texture'. Leaves the current framebuffer bound */
+        GLuint createFramebuffer(GLuint texture)
+        {
+            GLint screen;
+            GLuint id;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screen);
+            glGenFramebuffers(1, &id);
+            glBindFramebuffer(GL_FRAMEBUFFER, id);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, screen);
+            live.framebuffers++;
+            return id;
+        }
+        void deleteFramebuffer(GLuint id)
+        {
+            glDeleteFramebuffers(1, &id);
+            live.framebuffers--;
+        }
+        GLStats stats() const
+        {
+            return live;
+        }
+    private:
+        GLStats live;
+        map<GLuint, GLsizeiptr> buffersizes;
+};
+
+GLResources glresources;
+
+/* Delete a VAO together with the buffers it was built from */
+void destroy3DObject (struct VAO* vao)
+{
+    glresources.deleteBuffer(vao->VertexBuffer);
+    if(vao->IndexBuffer)
+        glresources.deleteBuffer(vao->IndexBuffer);
+    glresources.deleteVertexArray(vao->VertexArrayID);
+    delete vao;
+}
+
+/* Counted reference to a VAO. The VAO and its buffers are deleted as soon
+   as the last reference to it goes away */
+class VAORef
+{
+    public:
+        VAORef() : vao(NULL)
+        {
+        }
+        explicit VAORef(VAO* v) : vao(v)
+        {
+            retain();
+        }
+        VAORef(const VAORef& o) : vao(o.vao)
+        {
+            retain();
+        }
+        ~VAORef()
+        {
+            release();
+        }
+        VAORef& operator=(const VAORef& o)
+        {
+            VAO* old = vao;
+            vao = o.vao;
+            retain();
+            if(old && --old->RefCount==0)
+                destroy3DObject(old);
+            return *this;
+        }
+        operator VAO*() const
+        {
+            return vao;
+        }
+        VAO* operator->() const
+        {
+            return vao;
+        }
+    private:
+        void retain()
+        {
+            if(vao)
+                vao->RefCount++;
+        }
+        void release()
+        {
+            if(vao && --vao->RefCount==0)
+                destroy3DObject(vao);
+            vao = NULL;
+        }
+        VAO* vao;
+};
+
+/* How per-frame vertex data reaches the GPU */
+enum StreamMode
+{
+    STREAM_RING,        // mapped unsynchronized into a fenced ring of frame segments
+    STREAM_ORPHAN,      // glBufferSubData, orphaning the buffer when it is full
+    STREAM_SUBDATA,     // glBufferSubData from the start of the buffer every frame, for comparison
+};
+
+typedef struct StreamStats
+{
+    long writes;
+    long stalls;        // fence waits that found the GPU still busy
+    long orphans;
+}StreamStats;
+
+/* One GL buffer for data written once per frame. In ring mode the buffer
+   is split into 'segments' parts and every frame writes into its own part
+   through glMapBufferRange without synchronisation. At the end of each
+   frame every part it wrote is fenced, and a part is only reused after
+   the GPU has passed its fence, so the CPU never waits on the GPU unless
+   it gets more than 'segments' frames ahead. A frame that outgrows its
+   part carries on in the next one */
+class StreamBuffer
+{
+    public:
+        StreamBuffer() : id(0), segmentbytes(0), segments(0), segment(0), used(0), stats()
+        {
+        }
+        void init(GLenum target, size_t segmentbytes, int segments, StreamMode mode)
+        {
+            this->target = target;
+            this->segmentbytes = segmentbytes;
+            this->segments = segments;
+            this->mode = mode;
+            segment = 0;
+            used = 0;
+            fences.assign(segments, (GLsync)0);
+            touched.assign(segments, 0);
+            touched[0] = 1;
+            id = glresources.createBuffer(target, segmentbytes*segments, NULL, GL_STREAM_DRAW);
+        }
+        void release()
+        {
+            if(!id)
+                return;
+            for(int i=0;i<segments;i++)
+                if(fences[i])
+                    glDeleteSync(fences[i]);
+            glresources.deleteBuffer(id);
+            id = 0;
+        }
+        GLuint buffer() const
+        {
+            return id;
+        }
+        /* Copy 'bytes' of 'data' into the buffer and return the offset it
+           landed at, a multiple of 'alignment'. At least 'span' bytes are
+           kept free from there, for uniform blocks that are bound whole
+           but only partly written. Leaves the buffer bound to its target */
+        GLintptr write(const void* data, size_t bytes, size_t alignment=16, size_t span=0)
+        {
+            stats.writes++;
+            glstate.bindBuffer(target, id);
+            size_t reserved = bytes>span ? bytes : span;
+            if(mode!=STREAM_RING)
+                used = roundup(used, alignment);
+            if(mode==STREAM_SUBDATA)
+            {
+                if(used+reserved>segmentbytes*segments)
+                    used = 0;
+                GLintptr at = used;
+                glresources.updateBuffer(target, id, at, bytes, data);
+                used += roundup(reserved, 16);
+                return at;
+            }
+            if(mode==STREAM_ORPHAN)
+            {
+                if(used+reserved>segmentbytes*segments)
+                {
+                    glBufferData(target, segmentbytes*segments, NULL, GL_STREAM_DRAW);
+                    stats.orphans++;
+                    used = 0;
+                }
+                GLintptr at = used;
+                glresources.updateBuffer(target, id, at, bytes, data);
+                used += roundup(reserved, 16);
+                return at;
+            }
+            // align the offset in the whole buffer, segments need not be aligned
+            used = roundup(segment*segmentbytes+used, alignment) - segment*segmentbytes;
+            if(used+reserved>segmentbytes)  // frame outgrew its segment, carry on in the next
+            {
+                advance();
+                used = roundup(segment*segmentbytes, alignment) - segment*segmentbytes;
+            }
+            if(used+reserved>segmentbytes)
+            {
+                cerr<<"Stream write of "<<reserved<<" bytes does not fit in a "<<segmentbytes<<" byte segment"<<endl;
+                exit(EXIT_FAILURE);
+            }
+            GLintptr at = segment*segmentbytes + used;
+            void* dst = glMapBufferRange(target, at, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            memcpy(dst, data, bytes);
+            glUnmapBuffer(target);
+            glresources.uploaded(bytes);
+            used += roundup(reserved, 16);
+            return at;
+        }
+        /* Everything written so far belongs to the frame that just ended */
+        void endFrame()
+        {
+            if(mode==STREAM_RING)
+            {
+                // fence now, after the draws that read this frame's data
+                for(int i=0;i<segments;i++)
+                {
+                    if(!touched[i])
+                        continue;
+                    if(fences[i])
+                        glDeleteSync(fences[i]);
+                    fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    touched[i] = 0;
+                }
+                advance();
+            }
+            else if(mode==STREAM_SUBDATA)
+                used = 0;
+        }
+        StreamStats statistics() const
+        {
+            return stats;
+        }
+    private:
+        static size_t roundup(size_t bytes, size_t alignment)
+        {
+            return (bytes+alignment-1)/alignment*alignment;
+        }
+        /* Move on to the next segment, once the GPU is done with it */
+        void advance()
+        {
+            segment = (segment+1)%segments;
+            used = 0;
+            if(touched[segment])
+            {
+                // this frame went all the way round and has no fence yet
+                glFinish();
+                stats.stalls++;
+            }
+            touched[segment] = 1;
+            if(fences[segment])
+            {
+                GLenum r = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                if(r!=GL_ALREADY_SIGNALED)
+                    stats.stalls++;
+                if(r==GL_TIMEOUT_EXPIRED || r==GL_WAIT_FAILED)
+                    glFinish();     // never write over a segment the GPU may still read
+                glDeleteSync(fences[segment]);
+                fences[segment] = 0;
+            }
+        }
+        GLenum target;
+        GLuint id;
+        size_t segmentbytes;
+        int segments;
+        StreamMode mode;
+        int segment;        // part being written
+        size_t used;        // bytes of it already written
+        vector<GLsync> fences;
+        vector<char> touched;   // parts written this frame, fenced by endFrame()
+        StreamStats stats;
+};
+
+StreamBuffer stream;
+StreamMode streammode = STREAM_RING;
+const size_t streamsegment = 256*1024;  // a frame writes well under 100 KB
+
+/* Point attributes 0, 1, 3 and 4 of the bound VAO at Vertex2D data
+   starting at 'offset' in the bound array buffer, one vertex every
+   'stride' bytes. Enabling the arrays is left to whoever creates the VAO */
+void pointVertex2D (GLintptr offset, GLsizei stride=sizeof(Vertex2D))
+{
+    glVertexAttribPointer(
+            0,                  // attribute 0. Position
+            2,                  // size (x,y)
+            GL_FLOAT,           // type
+            GL_FALSE,           // normalized?
+            stride,             // stride
+            (void*)(offset+offsetof(Vertex2D, x))
+            );
+    glVertexAttribPointer(
+            1,                  // attribute 1. Color
+            4,                  // size (r,g,b,a)
+            GL_UNSIGNED_BYTE,   // type
+            GL_TRUE,            // normalized?
+            stride,             // stride
+            (void*)(offset+offsetof(Vertex2D, rgba))
+            );
+    glVertexAttribPointer(
+            3,                  // attribute 3. Position in a round shape
+            2,                  // size (u,v)
+            GL_BYTE,            // type
+            GL_TRUE,            // normalized?
+            stride,             // stride
+            (void*)(offset+offsetof(Vertex2D, u))
+            );
+    glVertexAttribPointer(
+            4,                  // attribute 4. Radii of a round shape
+            2,                  // size (outer,inner)
+            GL_UNSIGNED_BYTE,   // type
+            GL_TRUE,            // normalized?
+            stride,             // stride
+            (void*)(offset+offsetof(Vertex2D, outer))
+            );
+}
+
+/* Generate VAO, an interleaved VBO and an index buffer and return VAO handle */
+VAORef create2DObject (GLenum primitive_mode, int numVertices, const Vertex2D* vertex_buffer_data, int numIndices, const GLushort* index_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    struct VAO* vao = new struct VAO;
+    vao->PrimitiveMode = primitive_mode;
+    vao->NumVertices = numVertices;
+    vao->NumIndices = numIndices;
+    vao->FillMode = fill_mode;
+    vao->RefCount = 0;
+
+    // Create Vertex Array Object
+    // Should be done after CreateWindow and before any other GL calls
+    vao->VertexArrayID = glresources.createVertexArray(); // VAO
+
+    glstate.bindVertexArray (vao->VertexArrayID); // Bind the VAO 
+    vao->VertexBuffer = glresources.createBuffer(GL_ARRAY_BUFFER, numVertices*sizeof(Vertex2D), vertex_buffer_data, GL_STATIC_DRAW); // VBO - vertices and colors
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+    pointVertex2D(0);
+
+    vao->IndexBuffer = 0;
+    if(numIndices>0)
+        vao->IndexBuffer = glresources.createBuffer(GL_ELEMENT_ARRAY_BUFFER, numIndices*sizeof(GLushort), index_buffer_data, GL_STATIC_DRAW); // captured by the VAO
+
+    // bounds for culling: a box when drawn unrotated, a circle when rotated
+    vao->Bounds[0] = vao->Bounds[1] = vao->Bounds[2] = vao->Bounds[3] = 0;
+    vao->Radius = 0;
+    for(int i=0;i<numVertices;i++)
+    {
+        const Vertex2D& v = vertex_buffer_data[i];
+        vao->Bounds[0] = min(vao->Bounds[0], v.x);
+        vao->Bounds[1] = min(vao->Bounds[1], v.y);
+        vao->Bounds[2] = max(vao->Bounds[2], v.x);
+        vao->Bounds[3] = max(vao->Bounds[3], v.y);
+        vao->Radius = max(vao->Radius, (GLfloat)sqrt(v.x*v.x + v.y*v.y));
+    }
+
+    vao->Vertices.assign(vertex_buffer_data, vertex_buffer_data + numVertices);
+    if(numIndices>0)
+        vao->Indices.assign(index_buffer_data, index_buffer_data + numIndices);
+
+    return VAORef(vao);
+}
+
+/* Pack a colour channel in [0,1] into a normalized byte */
+GLubyte packchannel (GLfloat c)
+{
+    return (GLubyte)(c*255.0f + 0.5f);
+}
+
+/* Same as create2DObject, from separate x,y,z position and r,g,b colour
+   arrays. z is dropped; everything is drawn in the z=0 plane */
+VAORef create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, int numIndices, const GLushort* index_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    vector<Vertex2D> vertices(numVertices);
+    for(int i=0;i<numVertices;i++)
+    {
+        vertices[i].x = vertex_buffer_data[3*i];
+        vertices[i].y = vertex_buffer_data[3*i+1];
+        vertices[i].rgba[0] = packchannel(color_buffer_data[3*i]);
+        vertices[i].rgba[1] = packchannel(color_buffer_data[3*i+1]);
+        vertices[i].rgba[2] = packchannel(color_buffer_data[3*i+2]);
+        vertices[i].rgba[3] = 255;
+    }
+    return create2DObject(primitive_mode, numVertices, &vertices[0], numIndices, index_buffer_data, fill_mode);
+}
+
+/* Generate VAO, VBOs and return VAO handle */
+VAORef create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, 0, NULL, fill_mode);
+}
+
+/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+VAORef create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+{
+    vector<GLfloat> color_buffer_data(3*numVertices);
+    for (int i=0; i<numVertices; i++) {
+        color_buffer_data [3*i] = red;
+        color_buffer_data [3*i + 1] = green;
+        color_buffer_data [3*i + 2] = blue;
+    }
+
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
+}
+
+int drawcalls = 0;     // glDraw* calls issued since the start of the frame
+
+/**************************
+ * Customizable functions *
+ **************************/
+
+double diff;
+float l_speed = 0.30;
+double current_time;
+double old_time;
+int score=0;
+int penalty=5;
+double brickspeed=0.01;
+const float bricksize=0.20;
+int right_press=0;
+int level=1;
+int movered=0;
+int movegreen=0;
+
+typedef struct Color
+{
+    float r,g,b;
+}color;
+
+Vertex2D vertex2d(float x, float y, color c)
+{
+    Vertex2D v = {x, y, {packchannel(c.r), packchannel(c.g), packchannel(c.b), 255}};
+    return v;
+}
+
+/* Simulation state of a sprite, read and written every frame. Kept small
+   and trivially copyable; everything else lives in SpriteInfo */
+typedef struct Sprite
+{
+    float x,y;
+    float xspeed;
+    float yspeed;
+    float angle;
+    float height;
+    float width;
+    int status;
+}Sprite;
+
+static_assert(is_trivially_copyable<Sprite>::value, "Sprite must stay plain data");
+static_assert(sizeof(Sprite) <= 32, "Sprite must stay within half a cache line");
+
+/* Cold per-sprite data, only needed when creating or drawing the sprite */
+typedef struct SpriteInfo
+{
+    string name;
+    string component;
+    color c;
+    VAORef object;
+    int islaser;
+    int isbox;
+}SpriteInfo;
+
+
+/* Handle into the entity store. Sprites are created once at level load
+   and live until releaseGL(), so a handle is just the sprite's slot */
+typedef struct Handle
+{
+    unsigned int index;
+}Handle;
+
+inline bool operator==(Handle a, Handle b)
+{
+    return a.index==b.index;
+}
+
+/* Sprites that live for the whole game own fixed slots at the front of
+   the entity store, so game code addresses them as plain array indices */
+enum FixedEntity
+{
+    LASERBOX,
+    LASERBOX2,
+    LASER,
+    REDBOX,
+    GREENBOX,
+    MOVE1,
+    FIXED_COUNT
+};
+
+constexpr Handle fixedhandle(FixedEntity e)
+{
+    return Handle{(unsigned int)e};
+}
+
+/* Owns every sprite in one contiguous array. Sprites are addressed
+   through handles so nothing on the frame path hashes or walks a tree */
+class EntityStore
+{
+    public:
+        EntityStore() : sprites(FIXED_COUNT), infos(FIXED_COUNT)
+        {
+        }
+        Handle create(const Sprite& s, const SpriteInfo& info, int slot=-1)
+        {
+            if(slot>=0)
+            {
+                sprites[slot] = s;
+                infos[slot] = info;
+                return fixedhandle(FixedEntity(slot));
+            }
+            Handle h = {(unsigned int)sprites.size()};
+            sprites.push_back(s);
+            infos.push_back(info);
+            return h;
+        }
+        void clear()
+        {
+            sprites.assign(FIXED_COUNT, Sprite());
+            infos.clear();
+            infos.resize(FIXED_COUNT);
+        }
+        Sprite& operator[](Handle h)
+        {
+            return sprites[h.index];
+        }
+        Sprite& operator[](FixedEntity e)
+        {
+            return sprites[e];
+        }
+        SpriteInfo& info(Handle h)
+        {
+            return infos[h.index];
+        }
+        size_t size() const
+        {
+            return sprites.size();
+        }
+    private:
+        vector<Sprite> sprites;
+        vector<SpriteInfo> infos;
+};
+
+EntityStore entities;
+
+vector<Handle> boxes;  //store bottom boxes and laser boxes
+vector<Handle> mirror;  //store mirrors
+vector<Handle> background; //store background
+vector<Handle> moving; //store moving objects
+vector<Handle> speed; //store speed rectangles
+
+/* Position and rotation, in degrees, of a sprite */
+typedef struct Transform
+{
+    float x, y;
+    float angle;
+}Transform;
+
+/* 'local' placed in the frame of 'parent' */
+Transform compose(const Transform& parent, const Transform& local)
+{
+    float a = parent.angle*M_PI/180.0f;
+    Transform t;
+    t.x = parent.x + cos(a)*local.x - sin(a)*local.y;
+    t.y = parent.y + sin(a)*local.x + cos(a)*local.y;
+    t.angle = parent.angle + local.angle;
+    return t;
+}
+
+/* Node of the scene graph: a sprite placed relative to its parent */
+typedef struct SceneNode
+{
+    Handle sprite;
+    int parent;         // -1 for a root
+    Transform local;
+    Transform world;
+    bool dirty;         // local changed since the last update
+    bool moved;         // world changed in the last update
+    bool attached;      // the world transform is written to the sprite
+}SceneNode;
+
+/* Sprites that move together, each placed relative to its parent. The
+   world transform of a node is cached, and written to its sprite, only
+   when the node or one of its ancestors changed since the last update.
+   Parents are added before their children, so a single pass in order
+   brings every node up to date and a still node costs one flag test */
+class SceneGraph
+{
+    public:
+        SceneGraph() : recomputed(0)
+        {
+        }
+        int add(Handle sprite, const Transform& local, int parent=-1)
+        {
+            SceneNode n = {sprite, parent, local, local, true, false, true};
+            nodes.push_back(n);
+            return nodes.size()-1;
+        }
+        void clear()
+        {
+            nodes.clear();
+        }
+        const Transform& local(int node) const
+        {
+            return nodes[node].local;
+        }
+        void place(int node, const Transform& local)
+        {
+            SceneNode& n = nodes[node];
+            if(local.x==n.local.x && local.y==n.local.y && local.angle==n.local.angle)
+                return;
+            n.local = local;
+            n.dirty = true;
+        }
+        void move(int node, float dx, float dy)
+        {
+            Transform t = nodes[node].local;
+            t.x += dx;
+            t.y += dy;
+            place(node, t);
+        }
+        void rotate(int node, float degrees)
+        {
+            Transform t = nodes[node].local;
+            t.angle += degrees;
+            place(node, t);
+        }
+        /* Leave the sprite of 'node' to move on its own until attach() */
+        void detach(int node)
+        {
+            nodes[node].attached = false;
+        }
+        /* Put the sprite of 'node' back on its parent right away, so
+           nothing else this frame sees it where it was left */
+        void attach(int node)
+        {
+            SceneNode& n = nodes[node];
+            n.attached = true;
+            n.dirty = true;     // children follow on the next update()
+            recompute(n);
+        }
+        void update()
+        {
+            for(size_t i=0;i<nodes.size();i++)
+            {
+                SceneNode& n = nodes[i];
+                if(n.parent>=0 && nodes[n.parent].moved)
+                    n.dirty = true;
+                n.moved = n.dirty;
+                if(!n.dirty)
+                    continue;
+                recompute(n);
+                n.dirty = false;
+            }
+        }
+        long recomputations() const
+        {
+            return recomputed;
+        }
+    private:
+        void recompute(SceneNode& n)
+        {
+            n.world = n.parent>=0 ? compose(nodes[n.parent].world, n.local) : n.local;
+            recomputed++;
+            if(n.attached)
+            {
+                Sprite& s = entities[n.sprite];
+                s.x = n.world.x;
+                s.y = n.world.y;
+                s.angle = n.world.angle;
+            }
+        }
+        vector<SceneNode> nodes;
+        long recomputed;    // world transforms worked out since the start
+};
+
+SceneGraph scene;
+
+/* The cannon: a base, a barrel turning on it, and the laser, which rides
+   in the barrel until it is fired */
+typedef struct Cannon
+{
+    int base;
+    int barrel;
+    int laser;
+}Cannon;
+
+Cannon cannon;
+
+/* Build the cannon from wherever its sprites were created */
+void buildCannon()
+{
+    Transform base = {entities[LASERBOX].x, entities[LASERBOX].y, 0};
+    Transform barrel = {entities[LASERBOX2].x - base.x, entities[LASERBOX2].y - base.y, entities[LASERBOX2].angle};
+    Transform muzzle = {0, 0, 0};
+    cannon.base = scene.add(fixedhandle(LASERBOX), base);
+    cannon.barrel = scene.add(fixedhandle(LASERBOX2), barrel, cannon.base);
+    cannon.laser = scene.add(fixedhandle(LASER), muzzle, cannon.barrel);
+    scene.update();
+}
+
+/* The laser leaves the barrel and flies on its own */
+void firelaser()
+{
+    entities[LASER].status=1;
+    scene.detach(cannon.laser);
+}
+
+enum BrickKind { BLACKBRICK, REDBRICK, GREENBRICK, BRICK_KINDS };
+
+/* Live bricks of one kind stored as parallel arrays. A brick that dies is
+   swapped with the last live one, so the update loop only ever walks
+   live bricks. All storage is sized once in init(), so spawning never
+   allocates and memory stays bounded however long the game runs */
+class BrickGroup
+{
+    public:
+        vector<float> x;
+        vector<float> y;
+        vector<float> yspeed;
+        vector<unsigned char> alive;
+
+        size_t size() const
+        {
+            return x.size();
+        }
+        size_t limit() const
+        {
+            return capacity;
+        }
+        void init(size_t n)
+        {
+            capacity = n;
+            x.reserve(n);
+            y.reserve(n);
+            yspeed.reserve(n);
+            alive.reserve(n);
+        }
+        bool spawn(float px, float py, float speed)
+        {
+            if(size()>=capacity)
+                return false;
+            x.push_back(px);
+            y.push_back(py);
+            yspeed.push_back(speed);
+            alive.push_back(1);
+            return true;
+        }
+        void remove(size_t i)
+        {
+            size_t last = size()-1;
+            x[i] = x[last];
+            y[i] = y[last];
+            yspeed[i] = yspeed[last];
+            alive[i] = alive[last];
+            x.pop_back();
+            y.pop_back();
+            yspeed.pop_back();
+            alive.pop_back();
+        }
+    private:
+        size_t capacity;
+};
+
+/* What a brick of kind K does, resolved at compile time. A new kind
+   needs an enum value, a policy and a colour in brickcolors */
+template<BrickKind K> struct BrickPolicy;
+
+template<> struct BrickPolicy<BLACKBRICK>
+{
+    static const int hitscore = 1;      // score for shooting it
+    static const int basket = -1;       // basket that collects it, -1 for none
+    static const int misspenalty = 1;   // lives lost when it reaches the baskets
+};
+
+template<> struct BrickPolicy<REDBRICK>
+{
+    static const int hitscore = 0;
+    static const int basket = REDBOX;
+    static const int misspenalty = 0;
+};
+
+template<> struct BrickPolicy<GREENBRICK>
+{
+    static const int hitscore = 0;
+    static const int basket = GREENBOX;
+    static const int misspenalty = 0;
+};
+
+/* All live bricks, one group per kind, so every group is updated and
+   drawn without looking at the kind of each brick */
+class BrickPool
+{
+    public:
+        BrickGroup group[BRICK_KINDS];
+
+        size_t size() const
+        {
+            size_t n=0;
+            for(int k=0;k<BRICK_KINDS;k++)
+                n+=group[k].size();
+            return n;
+        }
+        size_t limit() const
+        {
+            size_t n=0;
+            for(int k=0;k<BRICK_KINDS;k++)
+                n+=group[k].limit();
+            return n;
+        }
+        void init(size_t n)     // n bricks of every kind
+        {
+            for(int k=0;k<BRICK_KINDS;k++)
+                group[k].init(n);
+        }
+        bool spawn(float px, float py, float speed, int k)
+        {
+            return group[k].spawn(px,py,speed);
+        }
+};
+
+BrickPool bricks;
+const size_t maxbricks = 64;    // far more than fit on screen at top speed
+
+const GLubyte brickcolors[BRICK_KINDS][4] = {
+    {0,0,0,255},        // BLACKBRICK
+    {255,0,0,255},      // REDBRICK
+    {0,255,0,255},      // GREENBRICK
+};
+
+/* Every sprite is drawn in a layer. There is no depth buffer: layers are
+   painted back to front in this order, so each one covers the ones
+   before it. A layer also sets how much its sprites grow with the zoom
+   level and whether they move with the pan */
+enum DrawLayer { LAYER_BACKGROUND, LAYER_SCENERY, LAYER_PLAYFIELD, LAYER_OBSTACLES, LAYER_BRICKS, LAYER_PROJECTILES, LAYER_HUD, LAYER_COUNT };
+
+static_assert(LAYER_BACKGROUND==0, "the background is painted first");
+static_assert(LAYER_SCENERY==LAYER_BACKGROUND+1 && LAYER_PLAYFIELD==LAYER_SCENERY+1, "static layers are painted before anything that moves");
+static_assert(LAYER_PLAYFIELD<LAYER_BRICKS && LAYER_OBSTACLES<LAYER_BRICKS, "bricks fall in front of the play field");
+static_assert(LAYER_BRICKS<LAYER_PROJECTILES, "the laser is drawn over the bricks it hits");
+static_assert(LAYER_HUD==LAYER_COUNT-1, "the HUD is painted last, over everything");
+
+const char* const layernames[LAYER_COUNT] = {"background", "scenery", "playfield", "obstacles", "bricks", "projectiles", "hud"};
+const GLfloat layerzoom[LAYER_COUNT] = {1.01f, 1.05f, 1.05f, 1.1f, 1.3f, 1.3f, 1.1f};
+const GLfloat layerpan[LAYER_COUNT] = {1, 1, 1, 1, 1, 1, 1};   // how far a layer moves with the pan
+const int layerstatic[LAYER_COUNT] = {1, 1, 0, 0, 0, 0, 0};    // nothing in it moves on its own, cached
+
+const int maxlayers = 8;    // size of the layer array of the Camera block
+static_assert(LAYER_COUNT <= maxlayers, "Camera block in the shaders must grow with the layers");
+
+/* Binding points of the uniform blocks shared by the programs */
+enum UniformBlock { CAMERA_BLOCK, SPRITE_BLOCK };
+
+/* Laid out like the std140 Camera block in the shaders */
+typedef struct CameraBlock
+{
+    GLfloat layerVP[maxlayers][16];     // projection * view * zoom and pan of each layer
+} CameraBlock;
+
+GLint uniformalign = 256;   // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, read in initGL
+
+/* Part of the world a layer shows, after its zoom and pan */
+typedef struct ViewBox
+{
+    GLfloat x0, y0, x1, y1;
+} ViewBox;
+
+/* Owns the projection, the view and the player's pan and zoom. From them
+   it builds one matrix per layer, with the layer's parallax folded in,
+   and keeps it in a uniform buffer of its own. Nothing is rebuilt or
+   uploaded unless one of them changed since the last frame */
+class Camera
+{
+    public:
+        Camera() : buffer(0), px(0), py(0), level(0), width(1), height(1), dirty(true), changes(0), block(), views()
+        {
+        }
+        void init()
+        {
+            buffer = glresources.createBuffer(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+        }
+        void release()
+        {
+            if(!buffer)
+                return;
+            glresources.deleteBuffer(buffer);
+            buffer = 0;
+        }
+        /* Projection for a window of width x height, in screen coordinates */
+        void project(const glm::mat4& projection, int width, int height)
+        {
+            this->projection = projection;
+            this->width = width;
+            this->height = height;
+            dirty = true;
+        }
+        void look(const glm::mat4& view)
+        {
+            this->view = view;
+            dirty = true;
+        }
+        void pan(float dx, float dy)
+        {
+            px += dx;
+            py += dy;
+            dirty = true;
+        }
+        void zoom(int steps)    // zoom level 0 shows every layer at its own size
+        {
+            level = max(level+steps, 0);
+            dirty = true;
+        }
+        float panx() const
+        {
+            return px;
+        }
+        float pany() const
+        {
+            return py;
+        }
+        /* Rebuild the layer matrices if anything changed and bind them
+           for every program */
+        void update()
+        {
+            if(dirty)
+            {
+                rebuild();
+                glresources.updateBuffer(GL_UNIFORM_BUFFER, buffer, 0, sizeof(block), &block);
+                dirty = false;
+                changes++;
+            }
+            glstate.bindUniformRange(CAMERA_BLOCK, buffer, 0, sizeof(block));
+        }
+        /* Bumped by every update() that changed the camera */
+        long version() const
+        {
+            return changes;
+        }
+        const ViewBox& visible(DrawLayer layer) const
+        {
+            return views[layer];
+        }
+        /* World position under screen position x,y in 'layer' */
+        glm::vec2 toWorld(double x, double y, DrawLayer layer) const
+        {
+            glm::vec4 ndc(2*x/width - 1, 1 - 2*y/height, 0, 1);
+            glm::vec4 world = inverses[layer]*ndc;
+            return glm::vec2(world.x, world.y);
+        }
+    private:
+        void rebuild()
+        {
+            glm::mat4 VP = projection * view;
+            for(int l=0;l<LAYER_COUNT;l++)
+            {
+                float zoom = level==0 ? 1 : layerzoom[l]*level;
+                glm::mat4 M = glm::scale(VP, glm::vec3(zoom, zoom, 1));
+                M = glm::translate(M, glm::vec3(layerpan[l]*px, layerpan[l]*py, 0));
+                memcpy(block.layerVP[l], &M[0][0], sizeof(block.layerVP[l]));
+
+                // the screen corners taken back into the layer, for culling
+                inverses[l] = glm::inverse(M);
+                glm::vec4 low = inverses[l]*glm::vec4(-1, -1, 0, 1);
+                glm::vec4 high = inverses[l]*glm::vec4(1, 1, 0, 1);
+                views[l].x0 = low.x;
+                views[l].y0 = low.y;
+                views[l].x1 = high.x;
+                views[l].y1 = high.y;
+            }
+        }
+        GLuint buffer;
+        glm::mat4 projection;
+        glm::mat4 view;
+        float px, py;       // pan
+        int level;          // zoom level, 0 for none
+        int width, height;  // of the window, for toWorld()
+        bool dirty;
+        long changes;
+        CameraBlock block;
+        glm::mat4 inverses[LAYER_COUNT];
+        ViewBox views[LAYER_COUNT];
+};
+
+Camera camera;
+
+/* Sprites handed to the batches, and those dropped for being off screen */
+typedef struct CullStats
+{
+    long submitted;
+    long culled;
+} CullStats;
+
+CullStats framecull;    // since the start of the frame
+CullStats totalcull;    // since the start of the game
+
+/* Whether any of the box x0,y0 - x1,y1 in 'layer' is on screen. Counts
+   the sprite as submitted or culled */
+bool onscreen(DrawLayer layer, float x0, float y0, float x1, float y1)
+{
+    const ViewBox& view = camera.visible(layer);
+    if(x1<view.x0 || x0>view.x1 || y1<view.y0 || y0>view.y1)
+    {
+        framecull.culled++;
+        totalcull.culled++;
+        return false;
+    }
+    framecull.submitted++;
+    totalcull.submitted++;
+    return true;
+}
+
+/* Attach the Camera block of 'program', and its Sprites block if it has one */
+void bindUniformBlocks(GLuint program)
+{
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Camera"), CAMERA_BLOCK);
+    GLuint sprites = glGetUniformBlockIndex(program, "Sprites");
+    if(sprites!=GL_INVALID_INDEX)
+        glUniformBlockBinding(program, sprites, SPRITE_BLOCK);
+}
+
+/* Per brick attributes of the instanced brick draw */
+typedef struct BrickInstance
+{
+    GLfloat x, y;
+    GLfloat size;
+    GLubyte rgba[4];
+} BrickInstance;
+
+/* Draws every live brick with a single instanced call: one shared unit
+   quad, plus centre, size and colour of each brick streamed once per
+   frame. Everything is sized in init(), so drawing never allocates */
+class BrickBatch
+{
+    public:
+        BrickBatch() : program(0), vao(0), quad(0)
+        {
+        }
+        void init(size_t n)     // room for n bricks
+        {
+            static const GLfloat unit_quad [] =
+            {
+                -0.5,-0.5,
+                0.5,-0.5,
+                0.5, 0.5,
+                -0.5,0.5,
+            };
+            staging.resize(n);
+            program = glresources.createProgram("Brick_GL.vert", "Sample_GL.frag");
+            bindUniformBlocks(program);
+
+            vao = glresources.createVertexArray();
+            glstate.bindVertexArray (vao);
+            quad = glresources.createBuffer(GL_ARRAY_BUFFER, sizeof(unit_quad), unit_quad, GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+            glEnableVertexAttribArray(2);   // centre
+            glVertexAttribDivisor(2, 1);
+            glEnableVertexAttribArray(3);   // size
+            glVertexAttribDivisor(3, 1);
+            glEnableVertexAttribArray(4);   // colour
+            glVertexAttribDivisor(4, 1);
+
+            glstate.useProgram (program);
+            glUniform1i(glGetUniformLocation(program, "layer"), LAYER_BRICKS);
+        }
+        void release()
+        {
+            if(!vao)
+                return;
+            glresources.deleteBuffer(quad);
+            glresources.deleteVertexArray(vao);
+            glresources.deleteProgram(program);
+            vao = 0;
+        }
+        /* Upload the live bricks of 'pool' that are on screen and draw
+           them with the camera of the frame. Leaves the brick program bound */
+        void draw(const BrickPool& pool)
+        {
+            size_t n=0;
+            for(int k=0;k<BRICK_KINDS;k++)
+            {
+                const BrickGroup& g = pool.group[k];
+                for(size_t i=0;i<g.size() && n<staging.size();i++)
+                {
+                    if(!onscreen(LAYER_BRICKS, g.x[i]-bricksize/2, g.y[i]-bricksize/2, g.x[i]+bricksize/2, g.y[i]+bricksize/2))
+                        continue;
+                    staging[n].x = g.x[i];
+                    staging[n].y = g.y[i];
+                    staging[n].size = bricksize;
+                    memcpy(staging[n].rgba, brickcolors[k], 4);
+                    n++;
+                }
+            }
+            if(n==0)
+                return;
+            GLintptr at = stream.write(&staging[0], n*sizeof(BrickInstance));
+
+            glstate.useProgram (program);
+            glstate.polygonMode (GL_FILL);
+            pointInstances(at);
+            glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n);
+            drawcalls++;
+        }
+    private:
+        /* Bind the VAO with the instance attributes reading from the
+           stream at 'at' */
+        void pointInstances(GLintptr at)
+        {
+            glstate.bindVertexArray (vao);
+            glstate.bindBuffer(GL_ARRAY_BUFFER, stream.buffer());
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)(at+offsetof(BrickInstance, x)));
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)(at+offsetof(BrickInstance, size)));
+            glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BrickInstance), (void*)(at+offsetof(BrickInstance, rgba)));
+        }
+        GLuint program;
+        GLuint vao;
+        GLuint quad;
+        vector<BrickInstance> staging;
+};
+
+BrickBatch brickbatch;
 
-    return ProgramID;
-}
+/* Segments of a seven-segment digit */
+enum Segment { SEG_TOP, SEG_CENTER, SEG_BOTTOM, SEG_UL, SEG_UR, SEG_BL, SEG_BR, SEGMENTS };
 
-static void error_callback(int error, const char* description)
+constexpr unsigned int segbit(Segment s)
 {
-    fprintf(stderr, "Error: %s\n", description);
+    return 1u<<s;
 }
 
-void quit(GLFWwindow *window)
-{
-    glfwDestroyWindow(window);
-    cout<<endl;
-    cout<<"Why you close game? :( "<<endl;
-    cout<<endl;
-    cout<<endl;
-    glfwTerminate();
-    //    exit(EXIT_SUCCESS);
-}
+/* Segments lit for each decimal digit */
+constexpr unsigned int digitsegments[10] = {
+    segbit(SEG_TOP)|segbit(SEG_BOTTOM)|segbit(SEG_UL)|segbit(SEG_UR)|segbit(SEG_BL)|segbit(SEG_BR),                      // 0
+    segbit(SEG_UR)|segbit(SEG_BR),                                                                                        // 1
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UR)|segbit(SEG_BL),                                  // 2
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UR)|segbit(SEG_BR),                                  // 3
+    segbit(SEG_CENTER)|segbit(SEG_UL)|segbit(SEG_UR)|segbit(SEG_BR),                                                      // 4
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UL)|segbit(SEG_BR),                                  // 5
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UL)|segbit(SEG_BL)|segbit(SEG_BR),                   // 6
+    segbit(SEG_TOP)|segbit(SEG_UR)|segbit(SEG_BR),                                                                        // 7
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UL)|segbit(SEG_UR)|segbit(SEG_BL)|segbit(SEG_BR),    // 8
+    segbit(SEG_TOP)|segbit(SEG_CENTER)|segbit(SEG_BOTTOM)|segbit(SEG_UL)|segbit(SEG_UR)|segbit(SEG_BR),                   // 9
+};
 
+static_assert(digitsegments[8]==(1u<<SEGMENTS)-1, "8 lights every segment");
+static_assert(digitsegments[1]==(segbit(SEG_UR)|segbit(SEG_BR)), "1 is the two right segments");
+static_assert((digitsegments[0]&segbit(SEG_CENTER))==0, "0 has no centre bar");
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Per digit attributes of the instanced seven segment draw */
+typedef struct DigitInstance
 {
-    struct VAO* vao = new struct VAO;
-    vao->PrimitiveMode = primitive_mode;
-    vao->NumVertices = numVertices;
-    vao->FillMode = fill_mode;
+    GLfloat x, y;       // centre of the digit
+    GLfloat w, h;
+    GLuint mask;        // lit segments, one bit per Segment
+    GLubyte rgba[4];
+} DigitInstance;
 
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-            0,                  // attribute 0. Vertices
-            3,                  // size (x,y,z)
-            GL_FLOAT,           // type
-            GL_FALSE,           // normalized?
-            0,                  // stride
-            (void*)0            // array buffer offset
-            );
+const int maxdigits = 12;   // score and lives together
 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-            1,                  // attribute 1. Color
-            3,                  // size (r,g,b)
-            GL_FLOAT,           // type
-            GL_FALSE,           // normalized?
-            0,                  // stride
-            (void*)0            // array buffer offset
-            );
+/* The numbers on the seven segment display, as lit segments */
+typedef struct Scoreboard
+{
+    DigitInstance digit[maxdigits];
+    int count;
+    int score, lives;   // numbers the digits show
+    int version;        // bumped every time the digits change
+} Scoreboard;
 
-    return vao;
-}
+Scoreboard board = {{}, 0, -1, -1, 0};
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+/* Where and how big a number is shown */
+typedef struct NumberLayout
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-        color_buffer_data [3*i] = red;
-        color_buffer_data [3*i + 1] = green;
-        color_buffer_data [3*i + 2] = blue;
+    float x, y;         // centre of the last digit
+    float w, h;
+    float advance;      // from one digit centre to the next
+    int mindigits;      // padded with leading zeros up to this many
+    GLubyte rgba[4];
+} NumberLayout;
+
+const NumberLayout scorelayout = {3.6, 3.3, 0.4, 1.0, 0.6, 2, {0,0,255,255}};
+const NumberLayout liveslayout = {-3.45, 3.4, 0.3, 0.8, 0.45, 1, {0,0,255,255}};
+
+/* Add the digits of 'value' to 'b', last digit first, growing to the left.
+   There are no digits for a minus sign, so negative values show as zero */
+void appendnumber(Scoreboard& b, const NumberLayout& l, int value)
+{
+    if(value<0)     // lives drop below zero when several bricks land at once
+        value = 0;
+    for(int i=0;b.count<maxdigits && (i<l.mindigits || value>0);i++)
+    {
+        DigitInstance& d = b.digit[b.count++];
+        d.x = l.x - i*l.advance;
+        d.y = l.y;
+        d.w = l.w;
+        d.h = l.h;
+        d.mask = digitsegments[value%10];
+        memcpy(d.rgba, l.rgba, 4);
+        value /= 10;
     }
-
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+/* Draws every digit of the scoreboard with a single instanced call. Each
+   instance is one digit: a fixed mesh of all seven segments, of which the
+   vertex shader drops the ones not in the digit's mask. Digits are only
+   uploaded when the scoreboard changes */
+class DigitBatch
 {
-    // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    public:
+        DigitBatch() : program(0), vao(0), segments(0), instances(0), count(0), version(-1)
+        {
+        }
+        void init()
+        {
+            program = glresources.createProgram("Digit_GL.vert", "Sample_GL.frag");
+            bindUniformBlocks(program);
+            glstate.useProgram (program);
+            glUniform1i(glGetUniformLocation(program, "layer"), LAYER_HUD);
+
+            // centre and half size of every segment in digit widths and
+            // heights, and which way its thickness goes
+            static const GLfloat layout[SEGMENTS][6] =
+            {
+                { 0, 0.5,   0.5, 0,     0, 1 },     // SEG_TOP
+                { 0, 0,     0.5, 0,     0, 1 },     // SEG_CENTER
+                { 0, -0.5,  0.5, 0,     0, 1 },     // SEG_BOTTOM
+                { -0.5, 0.25,   0, 0.25,    1, 0 }, // SEG_UL
+                { 0.5, 0.25,    0, 0.25,    1, 0 }, // SEG_UR
+                { -0.5, -0.25,  0, 0.25,    1, 0 }, // SEG_BL
+                { 0.5, -0.25,   0, 0.25,    1, 0 }, // SEG_BR
+            };
+            static const int corners[6][2] = { {-1,-1}, {1,-1}, {1,1}, {1,1}, {-1,1}, {-1,-1} };
+            const float halfthickness = 0.01;
+            SegmentVertex mesh[SEGMENTS*6];
+            for(int sgm=0;sgm<SEGMENTS;sgm++)
+                for(int c=0;c<6;c++)
+                {
+                    SegmentVertex& v = mesh[sgm*6+c];
+                    const GLfloat* l = layout[sgm];
+                    v.unit[0] = l[0] + corners[c][0]*l[2];
+                    v.unit[1] = l[1] + corners[c][1]*l[3];
+                    v.across[0] = corners[c][0]*l[4]*halfthickness;
+                    v.across[1] = corners[c][1]*l[5]*halfthickness;
+                    v.segment = sgm;
+                }
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+            vao = glresources.createVertexArray();
+            glstate.bindVertexArray (vao);
+            segments = glresources.createBuffer(GL_ARRAY_BUFFER, sizeof(mesh), mesh, GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SegmentVertex), (void*)offsetof(SegmentVertex, unit));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SegmentVertex), (void*)offsetof(SegmentVertex, across));
+            glEnableVertexAttribArray(2);
+            glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(SegmentVertex), (void*)offsetof(SegmentVertex, segment));
+
+            instances = glresources.createBuffer(GL_ARRAY_BUFFER, maxdigits*sizeof(DigitInstance), NULL, GL_DYNAMIC_DRAW);
+            glEnableVertexAttribArray(3);   // centre and size
+            glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(DigitInstance), (void*)offsetof(DigitInstance, x));
+            glVertexAttribDivisor(3, 1);
+            glEnableVertexAttribArray(4);   // mask
+            glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(DigitInstance), (void*)offsetof(DigitInstance, mask));
+            glVertexAttribDivisor(4, 1);
+            glEnableVertexAttribArray(5);   // colour
+            glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DigitInstance), (void*)offsetof(DigitInstance, rgba));
+            glVertexAttribDivisor(5, 1);
+        }
+        void release()
+        {
+            if(!vao)
+                return;
+            glresources.deleteBuffer(instances);
+            glresources.deleteBuffer(segments);
+            glresources.deleteVertexArray(vao);
+            glresources.deleteProgram(program);
+            vao = 0;
+        }
+        /* Draw the digits of 'b', uploading them first if they changed.
+           Leaves the digit program bound */
+        void draw(const Scoreboard& b)
+        {
+            if(b.version!=version)
+            {
+                if(b.count>0)
+                    glresources.updateBuffer(GL_ARRAY_BUFFER, instances, 0, b.count*sizeof(DigitInstance), b.digit);
+                count = b.count;
+                version = b.version;
+            }
+            if(count==0)
+                return;
+            glstate.useProgram (program);
+            glstate.polygonMode (GL_FILL);
+            glstate.bindVertexArray (vao);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, SEGMENTS*6, count);
+            drawcalls++;
+        }
+    private:
+        /* Corner of one segment of the digit mesh */
+        typedef struct SegmentVertex
+        {
+            GLfloat unit[2];    // in digit widths and heights from the centre
+            GLfloat across[2];  // thickness offset, in world units
+            GLuint segment;
+        } SegmentVertex;
+
+        GLuint program;
+        GLuint vao;
+        GLuint segments;
+        GLuint instances;
+        int count;
+        int version;        // of the scoreboard in 'instances'
+};
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+DigitBatch digits;
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* 64 bit FNV-1a of 'bytes' of 'data', continuing from 'hash' */
+unsigned long long fnv1a(unsigned long long hash, const void* data, size_t bytes)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for(size_t i=0;i<bytes;i++)
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    return hash;
 }
 
-/**************************
- * Customizable functions *
- **************************/
+const unsigned long long fnvbasis = 14695981039346656037ull;
 
-double diff;
-float l_speed = 0.30;
-double current_time;
-double old_time;
-int score=0;
-int penalty=5;
-double brickspeed=0.01;
-int right_press=0;
-int zoomlevel=0;
-int level=1;
-int movered=0;
-int movegreen=0;
-float panx=0;
-float pany=0;
+/* Vertex of the sprite batch: a vertex of the sprite's own mesh and
+   the index of the sprite's placement in the Sprites block */
+typedef struct SpriteVertex
+{
+    Vertex2D v;
+    GLuint sprite;
+} SpriteVertex;
 
-typedef struct Color
+/* Where a sprite is drawn, laid out like one entry of the std140 Sprites block */
+typedef struct SpritePlacement
 {
-    float r,g,b;
-}color;
+    GLfloat x, y;
+    GLfloat angle;      // radians
+    GLfloat layer;
+} SpritePlacement;
+
+const int maxsprites = 256;     // size of the Sprites block in Sample_GL.vert
+
+/* Collects the triangles of many sprites and streams them to the GPU to
+   be drawn with a single call. Vertices are copied as they are; each
+   sprite only adds its position, rotation and layer, and the vertex
+   shader places it. The batch is only flushed when the fill mode
+   changes, before something is drawn with another program, or when it
+   is full */
+class SpriteBatch
+{
+    public:
+        SpriteBatch() : vao(0), count(0), placed(0), fillmode(GL_FILL), fingerprinting(false), fingerprint(0)
+        {
+        }
+        void init(size_t n)     // room for n vertices between flushes
+        {
+            staging.resize(n);
+            placements.resize(maxsprites);
+            vao = glresources.createVertexArray();
+            glstate.bindVertexArray (vao);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+            glEnableVertexAttribArray(3);
+            glEnableVertexAttribArray(4);
+        }
+        void release()
+        {
+            if(!vao)
+                return;
+            glresources.deleteVertexArray(vao);
+            vao = 0;
+        }
+        /* Start a frame. Sprites are drawn with 'program', which reads
+           the camera bound by camera.update() */
+        void begin(GLuint program)
+        {
+            this->program = program;
+            count = 0;
+            placed = 0;
+        }
+        /* Queue the triangles of 'object' at x,y in 'layer', rotated by
+           'angle' degrees, unless it is entirely off screen */
+        void add(VAO* object, float x, float y, float angle, DrawLayer layer)
+        {
+            if(fingerprinting)
+            {
+                const void* key[] = {object};
+                float where[] = {x, y, angle, (float)layer};
+                fingerprint = fnv1a(fnv1a(fingerprint, key, sizeof(key)), where, sizeof(where));
+                return;
+            }
+            const GLfloat* b = object->Bounds;
+            GLfloat r = object->Radius;
+            if(angle==0 ? !onscreen(layer, x+b[0], y+b[1], x+b[2], y+b[3]) : !onscreen(layer, x-r, y-r, x+r, y+r))
+                return;
+            if(object->FillMode!=fillmode)
+            {
+                flush();
+                fillmode = object->FillMode;
+            }
+            int n = object->Indices.empty() ? object->NumVertices : object->NumIndices;
+            if(count+n>staging.size() || placed==placements.size())
+                flush();
+            SpritePlacement& p = placements[placed];
+            p.x = x;
+            p.y = y;
+            p.angle = (float)(angle*M_PI/180.0f);
+            p.layer = layer;
+            for(int i=0;i<n;i++)
+            {
+                int v = object->Indices.empty() ? i : object->Indices[i];
+                SpriteVertex& out = staging[count++];
+                out.v = object->Vertices[v];
+                out.sprite = placed;
+            }
+            placed++;
+        }
+        /* Until endFingerprint(), fold every sprite added into a
+           fingerprint starting from 'seed' instead of queueing it. Equal
+           fingerprints mean the same sprites in the same places */
+        void beginFingerprint(unsigned long long seed)
+        {
+            fingerprinting = true;
+            fingerprint = seed;
+        }
+        unsigned long long endFingerprint()
+        {
+            fingerprinting = false;
+            return fingerprint;
+        }
+        /* While fingerprinting, fold 'bytes' of 'data' in for something
+           drawn without the batch and return true: the caller skips the draw */
+        bool fold(const void* data, size_t bytes)
+        {
+            if(fingerprinting)
+                fingerprint = fnv1a(fingerprint, data, bytes);
+            return fingerprinting;
+        }
+        /* Draw everything queued so far */
+        void flush()
+        {
+            if(count==0)
+                return;
+            GLintptr at = stream.write(&staging[0], count*sizeof(SpriteVertex));
+            // the whole block is bound, only the sprites in use are written
+            GLintptr block = stream.write(&placements[0], placed*sizeof(SpritePlacement), uniformalign, placements.size()*sizeof(SpritePlacement));
+            glstate.bindUniformRange(SPRITE_BLOCK, stream.buffer(), block, placements.size()*sizeof(SpritePlacement));
+            glstate.useProgram (program);
+            glstate.polygonMode (fillmode);
+            glstate.bindVertexArray (vao);
+            glstate.bindBuffer(GL_ARRAY_BUFFER, stream.buffer());
+            pointVertex2D(at, sizeof(SpriteVertex));
+            glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(SpriteVertex), (void*)(at+offsetof(SpriteVertex, sprite)));
+            glDrawArrays(GL_TRIANGLES, 0, count);
+            drawcalls++;
+            count = 0;
+            placed = 0;
+        }
+    private:
+        GLuint vao;
+        size_t count;
+        size_t placed;      // sprites queued since the last flush
+        GLenum fillmode;
+        GLuint program;
+        vector<SpriteVertex> staging;
+        vector<SpritePlacement> placements;
+        bool fingerprinting;
+        unsigned long long fingerprint;
+};
 
-typedef struct Sprite
+SpriteBatch sprites;
+const size_t maxbatchvertices = 4096;
+
+/* Vertices of one layer in the baked static geometry that share a fill mode */
+typedef struct StaticRange
 {
-    string name;
-    color c;
-    float x,y;
-    VAO* object;
-    float height;
-    float width;
-    int islaser;
-    int isbox;
-    int status;
-    float angle;
-    float xspeed;
-    float yspeed;
-    string component;
-}Sprite;
+    DrawLayer layer;
+    GLenum fillmode;
+    GLint first;
+    GLsizei count;
+} StaticRange;
+
+const int maxstaticranges = 16;
+
+/* Sprites that never move, baked into one vertex buffer already placed
+   in the world, and drawn with one call per layer that needs nothing
+   but the camera. Game code calls edited() after changing a static
+   sprite; the bake is only rebuilt then. Everything is sized in init(),
+   so baking never allocates */
+class StaticGeometry
+{
+    public:
+        StaticGeometry() : program(0), vao(0), buffer(0), count(0), ranged(0), dirty(true), hashes(), versions()
+        {
+        }
+        void init(size_t n)     // room for n vertices
+        {
+            staging.resize(n);
+            program = glresources.createProgram("Static_GL.vert", "Sample_GL.frag");
+            bindUniformBlocks(program);
+            layeruniform = glGetUniformLocation(program, "layer");
+
+            vao = glresources.createVertexArray();
+            glstate.bindVertexArray (vao);
+            buffer = glresources.createBuffer(GL_ARRAY_BUFFER, n*sizeof(Vertex2D), NULL, GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(3);
+            glEnableVertexAttribArray(4);
+            pointVertex2D(0);
+        }
+        void release()
+        {
+            if(!vao)
+                return;
+            glresources.deleteBuffer(buffer);
+            glresources.deleteVertexArray(vao);
+            glresources.deleteProgram(program);
+            vao = 0;
+        }
+        void edited()
+        {
+            dirty = true;
+        }
+        bool stale() const
+        {
+            return dirty;
+        }
+        /* Start a new bake; add() every static sprite, then upload() */
+        void begin()
+        {
+            count = 0;
+            ranged = 0;
+        }
+        /* Place the triangles of 'object' at x,y in 'layer', rotated by
+           'angle' degrees */
+        void add(VAO* object, float x, float y, float angle, DrawLayer layer)
+        {
+            int n = object->Indices.empty() ? object->NumVertices : object->NumIndices;
+            if(count+n>staging.size())
+            {
+                cerr<<"Static geometry is full, "<<object->NumVertices<<" vertices left out"<<endl;
+                return;
+            }
+            if(ranged==0 || ranges[ranged-1].layer!=layer || ranges[ranged-1].fillmode!=object->FillMode)
+            {
+                if(ranged==maxstaticranges)
+                {
+                    cerr<<"Static geometry has too many ranges"<<endl;
+                    return;
+                }
+                StaticRange r = {layer, object->FillMode, (GLint)count, 0};
+                ranges[ranged++] = r;
+            }
+            float a = angle*M_PI/180.0f;
+            float c = cos(a), s = sin(a);
+            for(int i=0;i<n;i++)
+            {
+                int v = object->Indices.empty() ? i : object->Indices[i];
+                Vertex2D out = object->Vertices[v];
+                out.x = c*object->Vertices[v].x - s*object->Vertices[v].y + x;
+                out.y = s*object->Vertices[v].x + c*object->Vertices[v].y + y;
+                staging[count++] = out;
+            }
+            ranges[ranged-1].count += n;
+        }
+        void upload()
+        {
+            if(count>0)
+                glresources.updateBuffer(GL_ARRAY_BUFFER, buffer, 0, count*sizeof(Vertex2D), &staging[0]);
+            dirty = false;
+            // a layer's version only moves when its own vertices changed,
+            // so a bake for the HUD leaves the cached layers alone
+            for(int l=0;l<LAYER_COUNT;l++)
+            {
+                unsigned long long hash = fnvbasis;
+                for(int i=0;i<ranged;i++)
+                {
+                    const StaticRange& r = ranges[i];
+                    if(r.layer!=l)
+                        continue;
+                    GLenum fill[] = {r.fillmode};
+                    hash = fnv1a(hash, fill, sizeof(fill));
+                    hash = fnv1a(hash, &staging[r.first], r.count*sizeof(Vertex2D));
+                }
+                if(hash!=hashes[l])
+                {
+                    hashes[l] = hash;
+                    versions[l]++;
+                }
+            }
+        }
+        /* Draw the baked sprites of 'layer'. Leaves the static program
+           bound. While the sprite batch is fingerprinting only the
+           layer's version goes into the fingerprint, nothing is drawn */
+        void draw(DrawLayer layer)
+        {
+            if(sprites.fold(&versions[layer], sizeof(versions[layer])))
+                return;
+            for(int i=0;i<ranged;i++)
+            {
+                const StaticRange& r = ranges[i];
+                if(r.layer!=layer)
+                    continue;
+                glstate.useProgram (program);
+                glUniform1i(layeruniform, layer);
+                glstate.polygonMode (r.fillmode);
+                glstate.bindVertexArray (vao);
+                glDrawArrays(GL_TRIANGLES, r.first, r.count);
+                drawcalls++;
+            }
+        }
+    private:
+        GLuint program;
+        GLint layeruniform;
+        GLuint vao;
+        GLuint buffer;
+        vector<Vertex2D> staging;
+        size_t count;
+        StaticRange ranges[maxstaticranges];
+        int ranged;         // ranges in use
+        bool dirty;
+        unsigned long long hashes[LAYER_COUNT];  // of each layer's vertices at the last bake
+        long versions[LAYER_COUNT];             // bumped when a bake changes the layer
+};
+
+StaticGeometry statics;
+const size_t maxstaticvertices = 1024;
+
+/* Hits and misses of one cached layer */
+typedef struct LayerCacheStats
+{
+    long hits;      // frames the layer was the same as in the cached picture
+    long misses;    // frames it had changed and the picture was painted again
+}LayerCacheStats;
+
+int layercaching = 1;   // off with --no-layer-cache
+
+/* Keeps a picture of the static layers at the back of the scene, clear
+   colour included, and copies it to the screen in place of clearing it.
+   The sprites of every static layer, baked ones by their bake version,
+   and the camera are fingerprinted each frame without drawing anything,
+   and the picture is only painted again when a fingerprint changes */
+class LayerCache
+{
+    public:
+        LayerCache() : texture(0), framebuffer(0), width(0), height(0), painted(0), fingerprints(), stats()
+        {
+        }
+        /* Make the picture match a width x height framebuffer. It is
+           painted again on next use */
+        void resize(int w, int h)
+        {
+            release();
+            width = w;
+            height = h;
+            texture = glresources.createTexture(w, h);
+            framebuffer = glresources.createFramebuffer(texture);
+            painted = 0;
+        }
+        void release()
+        {
+            if(!texture)
+                return;
+            glresources.deleteFramebuffer(framebuffer);
+            glresources.deleteTexture(texture);
+            texture = framebuffer = 0;
+        }
+        /* Clear the screen and paint the static layers on it, with the
+           layer painters in 'painters'. Returns how many layers that was */
+        int paint(void (*const painters[LAYER_COUNT])())
+        {
+            int layers = 0;
+            bool changed = !painted;
+            long version = camera.version();
+            unsigned long long seed = fnv1a(fnvbasis, &version, sizeof(version));
+            sprites.flush();
+            for(;layers<LAYER_COUNT && layerstatic[layers];layers++)
+            {
+                sprites.beginFingerprint(seed);
+                painters[layers]();
+                unsigned long long fingerprint = sprites.endFingerprint();
+                if(painted && fingerprint==fingerprints[layers])
+                    stats[layers].hits++;
+                else
+                {
+                    fingerprints[layers] = fingerprint;
+                    stats[layers].misses++;
+                    changed = true;
+                }
+            }
 
+            GLint screen;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screen);
+            if(changed)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                glClear (GL_COLOR_BUFFER_BIT);
+                for(int l=0;l<layers;l++)
+                    painters[l]();
+                sprites.flush();
+                painted = 1;
+            }
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screen);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, screen);
+            return layers;
+        }
+        LayerCacheStats statistics(int l) const
+        {
+            return stats[l];
+        }
+    private:
+        GLuint texture;
+        GLuint framebuffer;
+        int width, height;
+        int painted;        // the picture matches 'fingerprints'
+        unsigned long long fingerprints[LAYER_COUNT];
+        LayerCacheStats stats[LAYER_COUNT];
+};
 
-map <string,Sprite> boxes;  //store bottom boxes and laser boxes
-map <string,Sprite> laser;  //store laser
-map <string,Sprite> brick;  //store brick
-map <string,Sprite> scoreboard;  //store scoreboard
-map <string,Sprite> mirror;  //store mirrors
-map <string,Sprite> background; //store background
-map <string,Sprite> moving; //store moving objects
-map <string, Sprite> speed; //store speed rectangles
+LayerCache layercache;
 
 void printn();
 void printm();
+void printglstats();
+void printsystems();
 
+#ifndef HEADLESS
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -279,52 +2204,44 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
             case GLFW_KEY_LEFT:                 
                 if(movered==1)                  //move red box left
                 {
-                    boxes["redbox"].x-=0.1;
+                    entities[REDBOX].x-=0.1;
                     break;
                 }
                 else if(movegreen==1)           //move green box left
-                    boxes["greenbox"].x-=0.1;
+                    entities[GREENBOX].x-=0.1;
                 break;
             case GLFW_KEY_RIGHT:
                 if(movered==1)                  //move red box right
                 {
-                    boxes["redbox"].x+=0.1;
+                    entities[REDBOX].x+=0.1;
                     break;
                 }
                 else if(movegreen==1)           //move green box right
-                    boxes["greenbox"].x+=0.1;
+                    entities[GREENBOX].x+=0.1;
                 break;
             case GLFW_KEY_J:
-                panx+=0.1;
+                camera.pan(0.1, 0);
                 break;
             case GLFW_KEY_L:
-                panx-=0.1;
+                camera.pan(-0.1, 0);
                 break;
             case GLFW_KEY_I:
-                pany-=0.1;
+                camera.pan(0, -0.1);
                 break;
             case GLFW_KEY_K:
-                pany+=0.1;
+                camera.pan(0, 0.1);
                 break;
             case GLFW_KEY_S:                    //move cannon up
-                boxes["laserbox"].y+=0.1;
-                boxes["laserbox2"].y+=0.1;
-                laser["laser"].y+=0.1;
+                scene.move(cannon.base, 0, 0.1);
                 break;
             case GLFW_KEY_F:                    //move cannon down
-                boxes["laserbox"].y-=0.1;
-                boxes["laserbox2"].y-=0.1;
-                laser["laser"].y-=0.1;
+                scene.move(cannon.base, 0, -0.1);
                 break;
             case GLFW_KEY_A:                    //increase angle of cannon
-                boxes["laserbox2"].angle+=10;
-                if(laser["laser"].status==0)
-                    laser["laser"].angle+=10;
+                scene.rotate(cannon.barrel, 10);
                 break;
             case GLFW_KEY_D:                    //decrease angle of cannon
-                boxes["laserbox2"].angle-=10;
-                if(laser["laser"].status==0)
-                    laser["laser"].angle-=10;
+                scene.rotate(cannon.barrel, -10);
                 break;
             case GLFW_KEY_N:                    //increase speed of bricks
                 printn();
@@ -333,12 +2250,16 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 printm();
                 break;
             case GLFW_KEY_UP:                   //zoom in
-                zoomlevel+=1;
+                camera.zoom(1);
                 break;
             case GLFW_KEY_DOWN:                 //zoom out
-                zoomlevel-=1;
-                if(zoomlevel<=0)
-                    zoomlevel=0;
+                camera.zoom(-1);
+                break;
+            case GLFW_KEY_G:                    //print live GL objects
+                printglstats();
+                break;
+            case GLFW_KEY_T:                    //print time spent per system
+                printsystems();
                 break;
             default:
                 break;
@@ -358,7 +2279,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 quit(window);
                 break;
             case GLFW_KEY_SPACE:                //shoot laser
-                laser["laser"].status=1;
+                firelaser();
                 break;
             default:
                 break;
@@ -369,54 +2290,46 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
         switch(key)
         {
             case GLFW_KEY_J:
-                panx+=0.1;
+                camera.pan(0.1, 0);
                 break;
             case GLFW_KEY_L:
-                panx-=0.1;
+                camera.pan(-0.1, 0);
                 break;
             case GLFW_KEY_I:
-                pany-=0.1;
+                camera.pan(0, -0.1);
                 break;
             case GLFW_KEY_K:
-                pany+=0.1;
+                camera.pan(0, 0.1);
                 break;
             case GLFW_KEY_A:                    //increase angleof cannon
-                boxes["laserbox2"].angle+=10;
-                if(laser["laser"].status==0)
-                    laser["laser"].angle+=10;
+                scene.rotate(cannon.barrel, 10);
                 break;
             case GLFW_KEY_D:                    //decrease angle of cannon
-                boxes["laserbox2"].angle-=10;
-                if(laser["laser"].status==0)
-                    laser["laser"].angle-=10;
+                scene.rotate(cannon.barrel, -10);
                 break;
             case GLFW_KEY_S:                    //move cannon up
-                boxes["laserbox"].y+=0.1;
-                boxes["laserbox2"].y+=0.1;
-                laser["laser"].y+=0.1;
+                scene.move(cannon.base, 0, 0.1);
                 break;
             case GLFW_KEY_F:                    //move cannon down
-                boxes["laserbox"].y-=0.1;
-                boxes["laserbox2"].y-=0.1;
-                laser["laser"].y-=0.1;
+                scene.move(cannon.base, 0, -0.1);
                 break;
             case GLFW_KEY_LEFT:                 
                 if(movered==1)                  //move red box left
                 {
-                    boxes["redbox"].x-=0.1;
+                    entities[REDBOX].x-=0.1;
                     break;
                 }
                 else if(movegreen==1)           //move green box left
-                    boxes["greenbox"].x-=0.1;
+                    entities[GREENBOX].x-=0.1;
                 break;
             case GLFW_KEY_RIGHT:
                 if(movered==1)                  //move red box right
                 {
-                    boxes["redbox"].x+=0.1;
+                    entities[REDBOX].x+=0.1;
                     break;
                 }
                 else if(movegreen==1)           //move green box right
-                    boxes["greenbox"].x+=0.1;
+                    entities[GREENBOX].x+=0.1;
                 break;
             default:
                 break;
@@ -443,7 +2356,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:                //left mouse button
             if (action == GLFW_RELEASE)
-                laser["laser"].status=1;
+                firelaser();
             break;
         case GLFW_MOUSE_BUTTON_RIGHT:               //right mouse button
             if (action == GLFW_PRESS)               //drag objects around
@@ -457,6 +2370,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
             break;
     }
 }
+#endif
 
 
 /* Executed when window is resized to 'width' and 'height' */
@@ -466,7 +2380,9 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     int fbwidth=width, fbheight=height;
     /* With Retina display on Mac OS X, GLFW's FramebufferSize
        is different from WindowSize */
+#ifndef HEADLESS
     glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+#endif
 
     GLfloat fov = 90.0f;
 
@@ -482,9 +2398,13 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
     // Ortho projection for 2D views
     Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
+    camera.project(Matrices.projection, width, height);
+
+    // static layers are cached at framebuffer resolution
+    layercache.resize(fbwidth, fbheight);
 }
 
-VAO *line, *rectangle,*rectangleb;
+VAORef line;
 
 // Creates the triangle object used in this sample code
 void createLine ()
@@ -508,69 +2428,128 @@ void createLine ()
     line = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_LINE);
 }
 
-// Creates the rectangle object used in this sample code
-void createRectangle (string name, float x,float y, color A,color B,color C,color D, float height, float width,int isbox,int islaser,string component) 
+/* Shape parameters a mesh is built from. Sprites with equal keys draw
+   byte-identical geometry, so they share one VAO */
+typedef struct MeshKey
+{
+    float v[16];    // shape, width, height, inner radius, then the four corner colours
+}MeshKey;
+
+bool operator<(const MeshKey& a, const MeshKey& b)
+{
+    return lexicographical_compare(a.v, a.v+16, b.v, b.v+16);
+}
+
+enum MeshShape { RECTANGLE_MESH, CIRCLE_MESH };
+
+typedef struct GeometryStats
+{
+    int meshes;         // distinct meshes built
+    int hits;           // requests served from the cache
+    long bytessaved;    // uploads the hits did not have to make
+}GeometryStats;
+
+/* Hands out one shared mesh per distinct shape */
+class GeometryCache
+{
+    public:
+        GeometryCache() : st()
+        {
+        }
+        VAORef find(const MeshKey& key)
+        {
+            map<MeshKey, Entry>::iterator it = meshes.find(key);
+            if(it==meshes.end())
+                return VAORef();
+            st.hits++;
+            st.bytessaved += it->second.bytes;
+            return it->second.mesh;
+        }
+        void insert(const MeshKey& key, const VAORef& mesh, long bytes)
+        {
+            Entry e = { mesh, bytes };
+            meshes[key] = e;
+            st.meshes++;
+        }
+        void clear()
+        {
+            meshes.clear();
+        }
+        GeometryStats stats() const
+        {
+            return st;
+        }
+    private:
+        struct Entry
+        {
+            VAORef mesh;
+            long bytes;
+        };
+        map<MeshKey, Entry> meshes;
+        GeometryStats st;
+};
+
+GeometryCache geometry;
+
+// Creates the VAO for a rectangle centred on the origin
+VAORef createRectangleObject (color A,color B,color C,color D, float height, float width)
 {
-    // GL3 accepts only Triangles. Quads are not supported
+    MeshKey key = {{ RECTANGLE_MESH, width, height, 0, A.r,A.g,A.b, B.r,B.g,B.b, C.r,C.g,C.b, D.r,D.g,D.b }};
+    VAORef mesh = geometry.find(key);
+    if(mesh)
+        return mesh;
+
+    // GL3 accepts only Triangles. Quads are drawn as two indexed triangles
     float w = width/2.0;
     float h = height/2.0;
 
-    GLfloat vertex_buffer_data [] = 
+    Vertex2D vertex_buffer_data [] = 
     {
-        -w,-h,0, // vertex 1
-        w,-h,0, // vertex 2
-        w, h,0, // vertex 3
-
-        w,h,0, // vertex 3
-        -w,h,0, // vertex 4
-        -w,-h,0  // vertex 1
+        vertex2d(-w,-h,A), // vertex 1
+        vertex2d(w,-h,B), // vertex 2
+        vertex2d(w, h,C), // vertex 3
+        vertex2d(-w,h,D), // vertex 4
     };
 
-    GLfloat color_buffer_data [] = 
+    static const GLushort index_buffer_data [] =
     {
-        A.r,A.g,A.b, // color 1
-        B.r,B.g,B.b, // color 2
-        C.r,C.g,C.b, // color 3
-
-        C.r,C.g,C.b, // color 3
-        D.r,D.g,D.b, // color 4
-        A.r,A.g,A.b  // color 1
+        0,1,2,
+        2,3,0
     };
 
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+    // create2DObject creates and returns a handle to a VAO that can be used later
+    mesh = create2DObject(GL_TRIANGLES, 4, vertex_buffer_data, 6, index_buffer_data, GL_FILL);
+    geometry.insert(key, mesh, sizeof(vertex_buffer_data)+sizeof(index_buffer_data));
+    return mesh;
+}
+
+// Creates the rectangle object used in this sample code
+Handle createRectangle (string name, float x,float y, color A,color B,color C,color D, float height, float width,int isbox,int islaser,string component,int slot=-1) 
+{
+    VAORef rectangle = createRectangleObject(A, B, C, D, height, width);
 
     Sprite prsprite = {};
+    SpriteInfo prinfo = {};
 
-    prsprite.name = name;
-    prsprite.c = A;
+    prinfo.name = name;
+    prinfo.c = A;
     prsprite.x = x;
     prsprite.y = y;
     prsprite.height = height;
     prsprite.width = width;
-    prsprite.object = rectangle;
-    prsprite.isbox=isbox;
-    prsprite.islaser=islaser;
+    prinfo.object = rectangle;
+    prinfo.isbox=isbox;
+    prinfo.islaser=islaser;
     prsprite.status=0;
-    if(component=="redbrick" || component == "blackbrick" || component == "greenbrick")
-    {
-        prsprite.yspeed=brickspeed;
-        prsprite.status=0;
-        prsprite.component = component;
-        brick[name]=prsprite;
-    }
-    else if(component=="score")
-    {
-        prsprite.status=0;
-        scoreboard[name]=prsprite;
-    }
-    else if(name=="laser")
+    prinfo.component = component;
+    Handle id;
+    if(name=="laser")
     {
         prsprite.status=0;
         prsprite.angle=0;
         prsprite.xspeed = 0.3;
         prsprite.yspeed = 0.2;
-        laser[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
     }
     else if(component=="mirror")
     {
@@ -578,75 +2557,118 @@ void createRectangle (string name, float x,float y, color A,color B,color C,colo
             prsprite.angle = 135;
         else if(name=="mirror2")
             prsprite.angle = 45;
-        mirror[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
+        mirror.push_back(id);
     }
     else if(component == "background")
     {
         prsprite.angle=45;
-        background[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
+        background.push_back(id);
     }
     else if(component == "moving")
     {
         prsprite.status=0;
-        moving[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
+        moving.push_back(id);
     }
     else if(component == "speed")
     {
-        speed[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
+        speed.push_back(id);
     }
     else
     {
         prsprite.status=0;
-        boxes[name]=prsprite;
+        id = entities.create(prsprite,prinfo,slot);
+        boxes.push_back(id);
     }
-
+    return id;
 }
 
-
-void createCircle (string name, color C, float x, float y, float r, int NoOfParts, string component)
+// Creates the VAO for a disc of radius r centred on the origin, or a ring
+// if 'inner' is not zero. It is one quad; the fragment shader cuts the
+// round edge out of it, so it costs four vertices at any size or zoom
+VAORef createCircleObject (color C, float r, float inner=0)
 {
-    int parts = NoOfParts;
-    float radius = r;
-    GLfloat vertex_buffer_data[parts*9];
-    GLfloat color_buffer_data[parts*9];
-    int i,j;
-    float angle=(2*M_PI/parts);
-    float current_angle = 0;
-    for(i=0;i<parts;i++)
+    MeshKey key = {{ CIRCLE_MESH, r, r, inner, C.r,C.g,C.b, C.r,C.g,C.b, C.r,C.g,C.b, C.r,C.g,C.b }};
+    VAORef mesh = geometry.find(key);
+    if(mesh)
+        return mesh;
+
+    // the quad is a little larger than the disc, so the antialiased rim
+    // is not cut off where it touches the quad's edges
+    const float margin = 1.25;
+    float s = r*margin;
+    GLubyte outer = (GLubyte)(255/margin);
+    GLubyte hole = (GLubyte)(255*inner/s);
+    Vertex2D vertex_buffer_data [] =
     {
-        for(j=0;j<3;j++)
-        {
-            color_buffer_data[i*9+j*3]=C.r;
-            color_buffer_data[i*9+j*3+1]=C.g;
-            color_buffer_data[i*9+j*3+2]=C.b;
-        }
-        vertex_buffer_data[i*9]=0;
-        vertex_buffer_data[i*9+1]=0;
-        vertex_buffer_data[i*9+2]=0;
-        vertex_buffer_data[i*9+3]=radius*cos(current_angle);
-        vertex_buffer_data[i*9+4]=radius*sin(current_angle);
-        vertex_buffer_data[i*9+5]=0;
-        vertex_buffer_data[i*9+6]=radius*cos(current_angle+angle);
-        vertex_buffer_data[i*9+7]=radius*sin(current_angle+angle);
-        vertex_buffer_data[i*9+8]=0;
-        current_angle+=angle;
+        vertex2d(-s,-s,C),
+        vertex2d(s,-s,C),
+        vertex2d(s, s,C),
+        vertex2d(-s,s,C),
+    };
+    static const GLbyte corners[4][2] = { {-127,-127}, {127,-127}, {127,127}, {-127,127} };
+    for(int i=0;i<4;i++)
+    {
+        vertex_buffer_data[i].u = corners[i][0];
+        vertex_buffer_data[i].v = corners[i][1];
+        vertex_buffer_data[i].outer = outer;
+        vertex_buffer_data[i].inner = hole;
     }
-    VAO* circle;
-    circle = create3DObject(GL_TRIANGLES, (parts*9)/3, vertex_buffer_data, color_buffer_data, GL_FILL);
+
+    static const GLushort index_buffer_data [] =
+    {
+        0,1,2,
+        2,3,0
+    };
+
+    mesh = create2DObject(GL_TRIANGLES, 4, vertex_buffer_data, 6, index_buffer_data, GL_FILL);
+    geometry.insert(key, mesh, sizeof(vertex_buffer_data)+sizeof(index_buffer_data));
+    return mesh;
+}
+
+Handle createCircle (string name, color C, float x, float y, float r, string component, float inner=0)
+{
+    VAORef circle = createCircleObject(C, r, inner);
     Sprite prsprite = {};
-    prsprite.c = C;
-    prsprite.name = name;
-    prsprite.object = circle;
+    SpriteInfo prinfo = {};
+    prinfo.c = C;
+    prinfo.name = name;
+    prinfo.object = circle;
     prsprite.x=x;
     prsprite.y=y;
     prsprite.angle = 0;
     prsprite.height=2*r;
     prsprite.width=2*r;
+    prinfo.component = component;
 
-    background[name]=prsprite;
+    Handle id = entities.create(prsprite,prinfo);
+    background.push_back(id);
+    return id;
 }
 
 float camera_rotation_angle = 90;
+const int warmupframes = 60;
+long warmupuntil = warmupframes;    // last frame still warming up
+bool bricksseen = false;            // a frame has drawn bricks
+
+/* Whether 'frame' is past warm-up, after which frames must not allocate.
+   Warm-up runs for 'warmupframes', and again from the first frame with
+   bricks in it: drivers build what a draw needs lazily (llvmpipe compiles
+   pipeline variants as the data they read moves), so allocations are
+   only checked once a full scene has been drawn for a while. So a frame
+   past warm-up can be followed by one inside it again */
+bool warmedup(long frame)
+{
+    if(!bricksseen && bricks.size()>0)
+    {
+        bricksseen = true;
+        warmupuntil = max(warmupuntil, frame+warmupframes);
+    }
+    return frame>warmupuntil;
+}
 
 void printn()
 {
@@ -657,11 +2679,10 @@ void printn()
         brickspeed=0.03;
         level=3;
     }
-    for(map<string,Sprite>::iterator it=brick.begin();it!=brick.end();it++)
-    {
-        string current=it->first;
-        brick[current].yspeed=brickspeed;
-    }
+    for(int k=0;k<BRICK_KINDS;k++)
+        for(size_t i=0;i<bricks.group[k].size();i++)
+            bricks.group[k].yspeed[i]=brickspeed;
+    statics.edited();   // the speed indicators show the level
 }
 
 void printm()
@@ -673,149 +2694,66 @@ void printm()
         brickspeed=0.01;
         level=1;
     }
-    for(map<string,Sprite>::iterator it=brick.begin();it!=brick.end();it++)
-    {
-        string current=it->first;
-        brick[current].yspeed=brickspeed;
-    }
+    for(int k=0;k<BRICK_KINDS;k++)
+        for(size_t i=0;i<bricks.group[k].size();i++)
+            bricks.group[k].yspeed[i]=brickspeed;
+    statics.edited();   // the speed indicators show the level
 }
 
-void checkcollision(string name, Sprite laser1)
+int checkcollision(BrickGroup& g, size_t b, const Sprite& laser1)
 {
     float t1;
-    t1 = sqrt(((brick[name].x-laser1.x)*(brick[name].x - laser1.x)) + ((brick[name].y - laser1.y)*(brick[name].y - laser1.y)));
+    t1 = sqrt(((g.x[b]-laser1.x)*(g.x[b] - laser1.x)) + ((g.y[b] - laser1.y)*(g.y[b] - laser1.y)));
     float t2;
-    t2 = (brick[name].width/2.0) + (laser1.width/2.0);
+    t2 = (bricksize/2.0) + (laser1.width/2.0);
     float t3;
-    t3 = (brick[name].height/2.0) + (laser1.height/2.0);
+    t3 = (bricksize/2.0) + (laser1.height/2.0);
     if((t1-t2<0.0) && (t1-t3<0.0))
     {
-        laser["laser"].status=0;
-        laser["laser"].x = boxes["laserbox2"].x;
-        laser["laser"].y = boxes["laserbox2"].y;
-        brick[name].status=1;
-        if(brick[name].component == "blackbrick")
-        {
-            score+=1;
-        }
-        return;
+        entities[LASER].status=0;
+        scene.attach(cannon.laser);
+        g.alive[b]=0;
+        return 1;
     }
-
+    return 0;
 }
 
-void checkbasketcollect(string name, float x,float y)
+void checkbasketcollect(BrickGroup& g, size_t b, float x,float y)
 {
-    if(brick[name].x >= x-0.5 && brick[name].x <= x + 0.5)
+    if(g.x[b] >= x-0.5 && g.x[b] <= x + 0.5)
     {
-        brick[name].status=1;
+        g.alive[b]=0;
         score+=1;
     }
     else
-        brick[name].status=0;
-}
-
-void lightitup(int sc,int bit)
-{
-    if(bit==0)
-    {
-        scoreboard["top1"].status=0;
-        scoreboard["center1"].status=0;
-        scoreboard["bottom1"].status=0;
-        scoreboard["ul1"].status=0;
-        scoreboard["ur1"].status=0;
-        scoreboard["br1"].status=0;
-        scoreboard["bl1"].status=0;
-        if(sc==2 || sc==3 || sc ==5 ||sc ==6 || sc ==7||sc ==8||sc==9||sc==0)
-            scoreboard["top1"].status=1;
-        if(sc==2||sc==3||sc==4||sc==5||sc==6||sc==8||sc==9)
-            scoreboard["center1"].status=1;
-        if(sc==2||sc==3||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["bottom1"].status=1;
-        if(sc==4||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["ul1"].status=1;
-        if(sc==1||sc==2||sc==3||sc==4||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["ur1"].status=1;
-        if(sc==2||sc==6||sc==8||sc==0)
-            scoreboard["bl1"].status=1;
-        if(sc==1||sc==3||sc==4||sc==5|sc==6||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["br1"].status=1;
-    }
-    else if(bit==1)
-    {
-        scoreboard["top2"].status=0;
-        scoreboard["center2"].status=0;
-        scoreboard["bottom2"].status=0;
-        scoreboard["ul2"].status=0;
-        scoreboard["ur2"].status=0;
-        scoreboard["br2"].status=0;
-        scoreboard["bl2"].status=0;
-        if(sc==2 || sc==3 || sc ==5 ||sc ==6 || sc ==7||sc ==8||sc==9||sc==0)
-            scoreboard["top2"].status=1;
-        if(sc==2||sc==3||sc==4||sc==5||sc==6||sc==8||sc==9)
-            scoreboard["center2"].status=1;
-        if(sc==2||sc==3||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["bottom2"].status=1;
-        if(sc==4||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["ul2"].status=1;
-        if(sc==1||sc==2||sc==3||sc==4||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["ur2"].status=1;
-        if(sc==2||sc==6||sc==8||sc==0)
-            scoreboard["bl2"].status=1;
-        if(sc==1||sc==3||sc==4||sc==5|sc==6||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["br2"].status=1;
-    }
-    else if (bit==2)
-    {
-        scoreboard["top3"].status=0;
-        scoreboard["center3"].status=0;
-        scoreboard["bottom3"].status=0;
-        scoreboard["ul3"].status=0;
-        scoreboard["ur3"].status=0;
-        scoreboard["br3"].status=0;
-        scoreboard["bl3"].status=0;
-        if(sc==2 || sc==3 || sc ==5 ||sc ==6 || sc ==7||sc ==8||sc==9||sc==0)
-            scoreboard["top3"].status=1;
-        if(sc==2||sc==3||sc==4||sc==5||sc==6||sc==8||sc==9)
-            scoreboard["center3"].status=1;
-        if(sc==2||sc==3||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["bottom3"].status=1;
-        if(sc==4||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["ul3"].status=1;
-        if(sc==1||sc==2||sc==3||sc==4||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["ur3"].status=1;
-        if(sc==2||sc==6||sc==8||sc==0)
-            scoreboard["bl3"].status=1;
-        if(sc==1||sc==3||sc==4||sc==5|sc==6||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["br3"].status=1;
-    }
-
+        g.alive[b]=1;
 }
 
 void checkbaskets()
 {
     float diff;
-    diff = abs(boxes["redbox"].x - boxes["greenbox"].x);
+    diff = abs(entities[REDBOX].x - entities[GREENBOX].x);
     if(diff<1.0)
     {
-        boxes["redbox"].status=1;
-        boxes["greenbox"].status=1;
+        entities[REDBOX].status=1;
+        entities[GREENBOX].status=1;
     }
     else
     {
-        boxes["redbox"].status=0;
-        boxes["greenbox"].status=0;
+        entities[REDBOX].status=0;
+        entities[GREENBOX].status=0;
     }
 
 }
 
-int checklasermirror(string lname, string mname)
+int checklasermirror(const Sprite& l, const Sprite& m)
 {
     float t1;
-    t1 = sqrt((laser["laser"].x - mirror[mname].x)*(laser["laser"].x - mirror[mname].x) + (laser["laser"].y - mirror[mname].y)*(laser["laser"].y - mirror[mname].y));
+    t1 = sqrt((l.x - m.x)*(l.x - m.x) + (l.y - m.y)*(l.y - m.y));
     float t2;
-    t2 = (laser["laser"].height/2.0) + (mirror[mname].height/2.0);
+    t2 = (l.height/2.0) + (m.height/2.0);
     float t3;
-    t3 = (laser["laser"].width/2.0) + (mirror[mname].width/2.0);
+    t3 = (l.width/2.0) + (m.width/2.0);
     if((t1-t2<0.0) && (t1-t3<0.0))
         return 1;
     else
@@ -825,349 +2763,283 @@ int checklasermirror(string lname, string mname)
 int chacklasermove()
 {
     float t1;
-    t1 = sqrt((laser["laser"].x - moving["move1"].x)*(laser["laser"].x - moving["move1"].x) + (laser["laser"].y - moving["move1"].y)*(laser["laser"].y - moving["move1"].y));
+    t1 = sqrt((entities[LASER].x - entities[MOVE1].x)*(entities[LASER].x - entities[MOVE1].x) + (entities[LASER].y - entities[MOVE1].y)*(entities[LASER].y - entities[MOVE1].y));
     float t2;
-    t2 = (moving["move1"].height/2.0) + (laser["laser"].height/2.0);
+    t2 = (entities[MOVE1].height/2.0) + (entities[LASER].height/2.0);
     float t3;
-    t3 = (moving["move1"].width/2.0) + (laser["laser"].width/2.0);
+    t3 = (entities[MOVE1].width/2.0) + (entities[LASER].width/2.0);
     if(t1<t2 && t1<t3)
         return 1;
     else
         return 0;
 }
 
-
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw (GLFWwindow* window)
+/* Let every live brick fall by one step */
+void moveBricks()
 {
-    // clear the color and depth in the frame buffer
-    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // use the loaded shader program
-    // Don't change unless you know what you are doing
-    glUseProgram (programID);
-
-    // Eye - Location of camera. Don't change unless you are sure!!
-    glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-    // Target - Where is the camera looking at.  Don't change unless you are sure!!
-    glm::vec3 target (0, 0, 0);
-    // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-    glm::vec3 up (0, 1, 0);
-
-    // Compute Camera matrix (view)
-    // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-    //  Don't change unless you are sure!!
-    Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-
-    // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-    //  Don't change unless you are sure!!
-    glm::mat4 VP = Matrices.projection * Matrices.view;
-
-    // Send our transformation to the currently bound shader, in the "MVP" uniform
-    // For each model you render, since the MVP will be different (at least the M part)
-    //  Don't change unless you are sure!!
-    glm::mat4 MVP;	// MVP = Projection * View * Model
-
-    // Load identity to model matrix
-    Matrices.model = glm::mat4(1.0f);
-
-    /* Render your scene */
-
-    glm::mat4 translateLine = glm::translate (glm::vec3(0.0f+panx, -2.8f+pany,0.0f)); // glTranslatef
-    glm::mat4 scaleLine;
-    if(zoomlevel==0)
-        scaleLine = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-    else if(zoomlevel!=0)
-        scaleLine = glm::scale (glm::vec3((1.05f*zoomlevel),1.05f*zoomlevel,1.05f*zoomlevel));
-    glm::mat4 lineTransform = scaleLine * translateLine;
-    Matrices.model *= lineTransform; 
-    MVP = VP * Matrices.model; // MVP = p * V * M
+    for(int k=0;k<BRICK_KINDS;k++)
+    {
+        BrickGroup& g = bricks.group[k];
+        for(size_t i=0;i<g.size();i++)
+            g.y[i]-=g.yspeed[i];
+    }
+}
 
-    // COMMENT- Don't change unless you are sure!!
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+/* Laser hits, basket collection and bricks of kind K falling out of the
+   screen. Bricks that die are swap-removed from their group */
+template<BrickKind K>
+void collideGroup(BrickGroup& g)
+{
+    typedef BrickPolicy<K> P;
+    size_t i=0;
+    while(i<g.size())
+    {
+        if(checkcollision(g,i,entities[LASER])) //check if laser is colliding with the brick
+            score+=P::hitscore;
+        if(g.alive[i] && g.y[i]<=-2.8)
+        {
+            if(P::basket>=0 && entities[FixedEntity(P::basket)].status==0)   //check if correct basket is collecting the brick
+                checkbasketcollect(g,i,entities[FixedEntity(P::basket)].x,entities[FixedEntity(P::basket)].y);
+            if(P::misspenalty)
+            {
+                penalty-=P::misspenalty;
+                g.alive[i]=0;
+            }
+        }
+        if(g.y[i]<=-3.1)  //check if brick is below the baskets. Remove it.
+            g.alive[i]=0;
 
-    // COMMENT- draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(line);
+        if(!g.alive[i])
+        {
+            g.remove(i);
+            continue;
+        }
+        i++;
+    }
+}
 
-    double newx,newy;
+void collideBricks()
+{
+    static_assert(BRICK_KINDS==3, "collide the new brick kind here");
+    collideGroup<BLACKBRICK>(bricks.group[BLACKBRICK]);
+    collideGroup<REDBRICK>(bricks.group[REDBRICK]);
+    collideGroup<GREENBRICK>(bricks.group[GREENBRICK]);
+}
 
+/* Put the laser back on the cannon, ready to fire again */
+void resetlaser()
+{
+    entities[LASER].status=0;
+    scene.attach(cannon.laser);
+}
 
+/* Cursor position in world coordinates, sampled once per frame */
+double cursorx, cursory;
 
-    // COMMENT- Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-    // COMMENT- glPopMatrix ();
-    for(map<string,Sprite>::iterator it=boxes.begin();it!=boxes.end();it++)
+/* Input: drag the baskets and the cannon with the mouse and keep them
+   inside the frame. Reads the cursor, writes box positions and the
+   cannon angle */
+void inputSystem()
+{
+    for(size_t i=0;i<boxes.size();i++)
     {
-        glfwGetCursorPos(window, &newx, &newy);
-        newx = newx/75 - 4;
-        newy = (-1*newy)/75 + 4;
-        
-        string current = it->first;
-        glm::mat4 translateRectangle;
-
-        Matrices.model = glm::mat4(1.0f);
-        if(boxes[current].isbox==1)
+        Sprite& current = entities[boxes[i]];
+        if(entities.info(boxes[i]).isbox==1)
         {
             if(right_press==1)
             {
-                if(boxes[current].x-0.5 <= newx && boxes[current].x + 0.5 >= newx && boxes[current].y - 0.5 <= newy && boxes[current].y + 0.5 >= newy)
+                if(current.x-0.5 <= cursorx && current.x + 0.5 >= cursorx && current.y - 0.5 <= cursory && current.y + 0.5 >= cursory)
                 {
-                    boxes[current].x = newx;
+                    current.x = cursorx;
                 }
             }
-            if(boxes[current].x>=3.5-panx)   //keep the box in the frame
+            if(current.x>=3.5-camera.panx())   //keep the box in the frame
             {
-                boxes[current].x=3.5-panx;
+                current.x=3.5-camera.panx();
             }
-            if(boxes[current].x<= -3.5)
-                boxes[current].x= -3.5;
-            translateRectangle = glm::translate (glm::vec3(boxes[current].x+panx,boxes[current].y+pany,0.0));// glTranslatef
+            if(current.x<= -3.5)
+                current.x= -3.5;
         }
-        else if(boxes[current].islaser==1)
+        else if(entities.info(boxes[i]).islaser==1)
         {
+            // the cannon moves and turns as one through its scene graph
+            Transform base = scene.local(cannon.base);
             if(right_press==1)
             {
-                if(boxes[current].x-0.5 <= newx && boxes[current].x + 0.5 >= newx && boxes[current].y - 0.5 <= newy && boxes[current].y + 0.5 >= newy)
-                {
-                    boxes["laserbox"].y = newy;
-                    boxes["laserbox2"].y = newy;
-                }
-            
-                double angtemp;
-                angtemp = atan(newy/newx)*180/M_PI;
-                boxes["laserbox2"].angle = angtemp;
-            }
-            if(boxes[current].y>=2.25)
-                boxes[current].y=2.25;
-            if(boxes[current].y<= -2.3)
-                boxes[current].y= -2.3;
-            translateRectangle = glm::translate (glm::vec3(boxes[current].x+panx,boxes[current].y+pany,0.0));// glTranslatef
-            if(boxes[current].name=="laserbox2")
-            {
-                glm::mat4 rotateRectangle = glm::rotate((float)(boxes["laserbox2"].angle*M_PI/180.0f),glm::vec3(0,0,1));
-                translateRectangle*=rotateRectangle;
+                if(current.x-0.5 <= cursorx && current.x + 0.5 >= cursorx && current.y - 0.5 <= cursory && current.y + 0.5 >= cursory)
+                    base.y = cursory;
+
+                Transform barrel = scene.local(cannon.barrel);
+                barrel.angle = atan(cursory/cursorx)*180/M_PI;
+                scene.place(cannon.barrel, barrel);
             }
+            if(base.y>=2.25)
+                base.y=2.25;
+            if(base.y<= -2.3)
+                base.y= -2.3;
+            scene.place(cannon.base, base);
         }
-        glm::mat4 scaleRectangle;
-        if(zoomlevel==0)
-            scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleRectangle = glm::scale (glm::vec3(1.05f*zoomlevel,1.05f*zoomlevel,1.05f*zoomlevel));
-        scaleRectangle *= translateRectangle;
-        Matrices.model *= (scaleRectangle);
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-        // draw3DObject draws the VAO given to it using current MVP matrix
-        draw3DObject(boxes[current].object);
     }
-    
-    for(map<string,Sprite>::iterator it=mirror.begin();it!=mirror.end();it++)
+}
+
+/* Update: bring the cannon up to date, then integrate the laser, bricks
+   and the moving obstacle by one frame. A laser that is not fired rides
+   in the barrel */
+void updateSystem()
+{
+    scene.update();
+
+    if(entities[LASER].status==1)
     {
-        string current = it->first;
-        glm::mat4 translateRectangle;
-        Matrices.model = glm::mat4(1.0f);
-        glm::mat4 scaleMirror;
-        if(zoomlevel==0)
-            scaleMirror = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleMirror = glm::scale (glm::vec3(1.05f*zoomlevel,1.05f*zoomlevel,1.05f*zoomlevel));
-        translateRectangle = glm::translate (glm::vec3(mirror[current].x+panx,mirror[current].y+pany,0.0));
-        glm::mat4 rotateRectangle = glm::rotate ((float)(mirror[current].angle*M_PI/180.0),glm::vec3(0,0,1));
-        scaleMirror *= translateRectangle;
-        scaleMirror*=rotateRectangle;
-        Matrices.model *= scaleMirror;
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(mirror[current].object);
+        diff = (current_time - old_time)*60;
+        entities[LASER].yspeed = sin(entities[LASER].angle*(M_PI/180))*l_speed;
+        entities[LASER].xspeed = cos(entities[LASER].angle*(M_PI/180))*l_speed;
+        entities[LASER].x+=diff*entities[LASER].xspeed;
+        entities[LASER].y+=diff*entities[LASER].yspeed;
     }
 
-    if(laser["laser"].status==1)
+    moveBricks();
+
+    for(size_t i=0;i<moving.size();i++)
     {
-        diff = (current_time - old_time)*60;
-        for(map<string,Sprite>::iterator it=mirror.begin();it!=mirror.end();it++)
+        Sprite& current = entities[moving[i]];
+        if(current.status==0)
+            current.y+=0.05;
+        else if(current.status==1)
+            current.y-=0.05;
+
+        if(current.y>=3.1)
+            current.status=1;
+        else if(current.y<=-3.1)
+            current.status=0;
+    }
+}
+
+/* Collide: laser against mirrors, the screen edge and the moving
+   obstacle, overlapping baskets, and bricks against laser and baskets.
+   Writes score, penalty and brick liveness */
+void collideSystem()
+{
+    if(entities[LASER].status==1)
+    {
+        for(size_t i=0;i<mirror.size();i++)
         {
-            string current = it->first;
-            if(checklasermirror(laser["laser"].name,mirror[current].name))
+            Sprite& current = entities[mirror[i]];
+            if(checklasermirror(entities[LASER],current))
             {
-                laser["laser"].yspeed = sin(laser["laser"].angle*(M_PI/180))*l_speed;
-                laser["laser"].xspeed = cos(laser["laser"].angle*(M_PI/180))*l_speed;
-                laser["laser"].x+=diff*laser["laser"].xspeed;
-                laser["laser"].y+=diff*laser["laser"].yspeed;
-                laser["laser"].angle = laser["laser"].angle + 2*mirror[current].angle;
-
+                entities[LASER].yspeed = sin(entities[LASER].angle*(M_PI/180))*l_speed;
+                entities[LASER].xspeed = cos(entities[LASER].angle*(M_PI/180))*l_speed;
+                entities[LASER].x+=diff*entities[LASER].xspeed;
+                entities[LASER].y+=diff*entities[LASER].yspeed;
+                entities[LASER].angle = entities[LASER].angle + 2*current.angle;
             }
         }
-        laser["laser"].yspeed = sin(laser["laser"].angle*(M_PI/180))*l_speed;
-        laser["laser"].xspeed = cos(laser["laser"].angle*(M_PI/180))*l_speed;
-        laser["laser"].x+=diff*laser["laser"].xspeed;
-        laser["laser"].y+=diff*laser["laser"].yspeed;
-        Matrices.model = glm::mat4(1.0f);
-        glm::mat4 scaleRectangle;
-        if(zoomlevel==0)
-            scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleRectangle = glm::scale (glm::vec3(1.3f*zoomlevel,1.3f*zoomlevel,1.3f*zoomlevel));
-        glm::mat4 translateRectangle = glm::translate (glm::vec3(laser["laser"].x,laser["laser"].y,0.0));
-        glm::mat4 rotateRectangle = glm::rotate((float)(laser["laser"].angle*M_PI/180.0f),glm::vec3(0,0,1));
-        scaleRectangle*= translateRectangle * rotateRectangle;
-        Matrices.model *= (scaleRectangle);
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(laser["laser"].object);
-        if(laser["laser"].x>4.0 || laser["laser"].x<-4.0)
-        {
-            laser["laser"].status=0;
-            laser["laser"].x = boxes["laserbox2"].x + panx;
-            laser["laser"].y = boxes["laserbox2"].y;
-            laser["laser"].angle = boxes["laserbox2"].angle;
-        }
-        if(laser["laser"].y>4.0 || laser["laser"].y<-4.0)
-        {
-            laser["laser"].status=0;
-            laser["laser"].x = boxes["laserbox2"].x + panx;
-            laser["laser"].y = boxes["laserbox2"].y;
-            laser["laser"].angle = boxes["laserbox2"].angle;
-        }
-        int stat=0;
-        stat = chacklasermove();
-        if(stat)
-        {
-            laser["laser"].status=0;
-            laser["laser"].x = boxes["laserbox2"].x + panx;
-            laser["laser"].y = boxes["laserbox2"].y;
-            laser["laser"].angle = boxes["laserbox2"].angle;
-        }
-
+        if(entities[LASER].x>4.0 || entities[LASER].x<-4.0)
+            resetlaser();
+        if(entities[LASER].y>4.0 || entities[LASER].y<-4.0)
+            resetlaser();
+        if(chacklasermove())
+            resetlaser();
     }
-    else if(laser["laser"].status==0)
+
+    checkbaskets();
+    collideBricks();
+}
+
+/* Score: show score and lives on the seven segment display. The digits
+   are only worked out again when one of the numbers changes */
+void scoreSystem()
+{
+    if(score==board.score && penalty==board.lives)
+        return;
+    board.score = score;
+    board.lives = penalty;
+    board.count = 0;
+    appendnumber(board, scorelayout, score);
+    appendnumber(board, liveslayout, penalty);
+    board.version++;
+}
+
+/* Queue the sprites of one layer each. renderSystem paints them in
+   DrawLayer order */
+void drawBackground()
+{
+    sprites.flush();
+    statics.draw(LAYER_BACKGROUND);
+}
+
+void drawScenery()
+{
+    statics.draw(LAYER_SCENERY);
+}
+
+void drawPlayfield()
+{
+    for(size_t i=0;i<boxes.size();i++)
     {
-        laser["laser"].x = boxes["laserbox2"].x + panx;
-        laser["laser"].y = boxes["laserbox2"].y;
-        laser["laser"].angle = boxes["laserbox2"].angle;
+        Sprite& current = entities[boxes[i]];
+        float angle = 0;
+        if(boxes[i]==fixedhandle(LASERBOX2))
+            angle = current.angle;
+        sprites.add(entities.info(boxes[i]).object, current.x, current.y, angle, LAYER_PLAYFIELD);
     }
+}
 
-    checkbaskets();
-    
-    for(map<string,Sprite>::iterator it=brick.begin();it!=brick.end();it++)
+void drawObstacles()
+{
+    for(size_t i=0;i<moving.size();i++)
     {
-        string current = it->first;
-        glm::mat4 translateRectangle;
-        Matrices.model = glm::mat4(1.0f);
-        if(brick[current].status==0) //check if laser is colliding with the laser
-            checkcollision(brick[current].name,laser["laser"]);
-        if(brick[current].status==0)
-            if(brick[current].y<=-2.8)
-                if(brick[current].component=="redbrick" && boxes["redbox"].status==0)   //check if correct basket is collecting the brick
-                    checkbasketcollect(brick[current].name,boxes["redbox"].x,boxes["redbox"].y);
-                else if(brick[current].component == "greenbrick" && boxes["greenbox"].status==0) 
-                    checkbasketcollect(brick[current].name, boxes["greenbox"].x, boxes["greenbox"].y);
-                else if(brick[current].component == "blackbrick")
-                {
-                    penalty-=1;
-                    brick[current].status=1;
-                }
-        if(brick[current].y<=-3.1)  //check if brick is below the baskets. Remove it.
-            brick[current].status=1;
-
-        if(brick[current].status!=1)
-        {
-            brick[current].y-=brick[current].yspeed;
-            glm::mat4 scaleRectangle;
-            if(zoomlevel==0)
-                scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-            else if(zoomlevel!=0)
-                scaleRectangle = glm::scale (glm::vec3(1.3f*zoomlevel,1.3f*zoomlevel,1.3f*zoomlevel));
-            translateRectangle = glm::translate (glm::vec3(brick[current].x+panx,brick[current].y+pany,0.0));
-            Matrices.model *= scaleRectangle * translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(brick[current].object);
-        }
-        else
-        {
-            int example =1;
-        }
+        Sprite& current = entities[moving[i]];
+        sprites.add(entities.info(moving[i]).object, current.x, current.y, 0, LAYER_OBSTACLES);
     }
-    lightitup(score%10,0);
-    int temps;
-    temps=score/10;
-    lightitup(temps,1);
-    lightitup(penalty,2);
-    for(map<string,Sprite>::iterator it=scoreboard.begin();it!=scoreboard.end();it++)
+}
+
+void drawBricks()
+{
+    // every brick in one call; the instance offset is the brick position
+    sprites.flush();
+    brickbatch.draw(bricks);
+}
+
+void drawProjectiles()
+{
+    if(entities[LASER].status==1)
     {
-        string current = it->first;
-        glm::mat4 translateRectangle;
-        Matrices.model = glm::mat4(1.0f);
-
-        if(scoreboard[current].status==1)
-        {
-            glm::mat4 scaleRectangle;
-            if(zoomlevel==0)
-                scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-            else if(zoomlevel!=0)
-                scaleRectangle = glm::scale (glm::vec3(1.1f*zoomlevel,1.1f*zoomlevel,1.1f*zoomlevel));
-            translateRectangle = glm::translate (glm::vec3(scoreboard[current].x+panx,scoreboard[current].y+pany,0.0));
-            Matrices.model *= scaleRectangle * translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(scoreboard[current].object);
-        }
+        Sprite& current = entities[LASER];
+        sprites.add(entities.info(fixedhandle(LASER)).object, current.x, current.y, current.angle, LAYER_PROJECTILES);
     }
-    for(map<string,Sprite>::iterator it=background.begin();it!=background.end();it++)
+}
+
+void drawHud()
+{
+    // every digit of the score and lives in one call
+    sprites.flush();
+    digits.draw(board);
+    statics.draw(LAYER_HUD);
+}
+
+/* Bake the background, the scenery and the speed indicators that are lit
+   into the static geometry */
+void bakeStatics()
+{
+    statics.begin();
+    for(size_t i=0;i<background.size();i++)
     {
-        string current = it->first;
-        glm::mat4 translateCircle;
-        Matrices.model = glm::mat4(1.0f);
-
-        glm::mat4 scaleRectangle;
-        if(zoomlevel==0)
-            scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleRectangle = glm::scale (glm::vec3(1.01f*zoomlevel,1.01f*zoomlevel,1.01f*zoomlevel));
-        translateCircle = glm::translate (glm::vec3(background[current].x + panx,background[current].y+pany, 0.0));
-        glm::mat4 rotateCircle = glm::rotate((float)(background[current].angle*M_PI/180.0f),glm::vec3(0,0,1));
-        scaleRectangle *= translateCircle * rotateCircle;
-        Matrices.model *= scaleRectangle;
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(background[current].object);
+        Sprite& current = entities[background[i]];
+        statics.add(entities.info(background[i]).object, current.x, current.y, current.angle, LAYER_BACKGROUND);
     }
 
-    for(map<string,Sprite>::iterator it=moving.begin();it!=moving.end();it++)
+    statics.add(line, 0.0f, -2.8f, 0, LAYER_SCENERY);
+    for(size_t i=0;i<mirror.size();i++)
     {
-        string current = it->first;
-        glm::mat4 translateRectangle;
-        Matrices.model = glm::mat4(1.0f);
-        if(moving[current].status==0)
-            moving[current].y+=0.05;
-        else if(moving[current].status==1)
-            moving[current].y-=0.05;
-
-        if(moving[current].y>=3.1)
-            moving[current].status=1;
-        else if(moving[current].y<=-3.1)
-            moving[current].status=0;
-
-        glm::mat4 scaleRectangle;
-        if(zoomlevel==0)
-            scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleRectangle = glm::scale (glm::vec3(1.1f*zoomlevel,1.1f*zoomlevel,1.1f*zoomlevel));
-
-        translateRectangle = glm::translate (glm::vec3(moving[current].x+panx,moving[current].y+pany,0.0));
-        scaleRectangle *= translateRectangle;
-        Matrices.model *= scaleRectangle;
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(moving[current].object);
+        Sprite& current = entities[mirror[i]];
+        statics.add(entities.info(mirror[i]).object, current.x, current.y, current.angle, LAYER_SCENERY);
     }
+
     int s1=1,s2=0,s3=0;
-    for(map<string,Sprite>::iterator it=speed.begin();it!=speed.end();it++)
+    for(size_t i=0;i<speed.size();i++)
     {
-        string current = it->first;
-        glm::mat4 translateRectangle;
-        Matrices.model = glm::mat4(1.0f);
+        Sprite& current = entities[speed[i]];
         if(level>=2)
             s2=1;
         else
@@ -1177,44 +3049,118 @@ void draw (GLFWwindow* window)
         else
             s3=0;
 
-        glm::mat4 scaleRectangle;
-        if(zoomlevel==0)
-            scaleRectangle = glm::scale (glm::vec3(1.0f,1.0f,1.0f));
-        else if(zoomlevel!=0)
-            scaleRectangle = glm::scale (glm::vec3(1.1f*zoomlevel,1.1f*zoomlevel,1.1f*zoomlevel));
-        if(speed[current].name=="speed1")
-        {
-            translateRectangle = glm::translate (glm::vec3(speed[current].x+panx,speed[current].y+pany,0.0));
-            scaleRectangle *= translateRectangle;
-            Matrices.model *= scaleRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(speed[current].object);
-        }
-        if(speed[current].name=="speed2")
-            if(s2==1)
-            {
-                translateRectangle = glm::translate (glm::vec3(speed[current].x+panx,speed[current].y+pany,0.0));
-                scaleRectangle *= translateRectangle;
-                Matrices.model *= scaleRectangle;
-                MVP = VP * Matrices.model;
-                glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(speed[current].object);
-            }
-        if(speed[current].name == "speed3")
-            if(s3==1)
-            {
-                translateRectangle = glm::translate (glm::vec3(speed[current].x+panx,speed[current].y+pany,0.0));
-                scaleRectangle *= translateRectangle;
-                Matrices.model *= scaleRectangle;
-                MVP = VP * Matrices.model;
-                glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(speed[current].object);
-            }
+        // speed rectangles are stored in creation order: speed1, speed2, speed3
+        if(i==0 || (i==1 && s2==1) || (i==2 && s3==1))
+            statics.add(entities.info(speed[i]).object, current.x, current.y, 0, LAYER_HUD);
     }
-    
+    statics.upload();
+}
+
+constexpr void (*layerpainters[LAYER_COUNT])() = {
+    drawBackground,     // LAYER_BACKGROUND
+    drawScenery,        // LAYER_SCENERY
+    drawPlayfield,      // LAYER_PLAYFIELD
+    drawObstacles,      // LAYER_OBSTACLES
+    drawBricks,         // LAYER_BRICKS
+    drawProjectiles,    // LAYER_PROJECTILES
+    drawHud,            // LAYER_HUD
+};
+
+static_assert(layerpainters[LAYER_BACKGROUND]==drawBackground && layerpainters[LAYER_SCENERY]==drawScenery
+        && layerpainters[LAYER_PLAYFIELD]==drawPlayfield
+        && layerpainters[LAYER_OBSTACLES]==drawObstacles && layerpainters[LAYER_BRICKS]==drawBricks
+        && layerpainters[LAYER_PROJECTILES]==drawProjectiles && layerpainters[LAYER_HUD]==drawHud,
+        "every layer must be painted by its own function");
+
+/* Render the scene with openGL. Only reads simulation state */
+void renderSystem()
+{
+    drawcalls = 0;
+    framecull = CullStats();
+
+    // The camera is the only transform built on the CPU, and only when
+    // it moved; every sprite is placed by the vertex shader from its
+    // position, angle and the matrix of its layer
+    camera.update();
+    if(statics.stale())
+        bakeStatics();
+
+    /* Render your scene, back to front. There is no depth buffer. The
+       screen is cleared, or the cached static layers copied over it */
+    sprites.begin(programID);
+    int first = 0;
+    if(layercaching)
+        first = layercache.paint(layerpainters);
+    else
+        glClear (GL_COLOR_BUFFER_BIT);
+    for(int l=first;l<LAYER_COUNT;l++)
+        layerpainters[l]();
+
+    sprites.flush();
+    stream.endFrame();
+}
+
+/* One stage of the frame pipeline. Stages run in order, can be switched
+   off one by one and remember how long they took on the last frame */
+typedef struct System
+{
+    const char* name;
+    void (*run)();
+    int enabled;
+    double us;
+} System;
+
+enum SystemId {INPUT_SYSTEM, UPDATE_SYSTEM, COLLIDE_SYSTEM, SCORE_SYSTEM, RENDER_SYSTEM, SYSTEM_COUNT};
+
+System systems[SYSTEM_COUNT] = {
+    {"input", inputSystem, 1, 0},
+    {"update", updateSystem, 1, 0},
+    {"collide", collideSystem, 1, 0},
+    {"score", scoreSystem, 1, 0},
+    {"render", renderSystem, 1, 0},
+};
+
+/* Run one frame of every enabled system */
+void runSystems()
+{
+    for(int s=0;s<SYSTEM_COUNT;s++)
+    {
+        if(!systems[s].enabled)
+            continue;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        systems[s].run();
+        systems[s].us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+void printsystems()
+{
+    cout<<"Frame:";
+    for(int s=0;s<SYSTEM_COUNT;s++)
+    {
+        if(systems[s].enabled)
+            cout<<" "<<systems[s].name<<" "<<systems[s].us<<" us";
+        else
+            cout<<" "<<systems[s].name<<" off";
+    }
+    cout<<", "<<drawcalls<<" draws, "<<framecull.submitted<<" sprites, "<<framecull.culled<<" culled"<<endl;
+}
+
+/* Sample the cursor and run one frame of the pipeline. Without a window
+   (headless) the cursor stays in the corner */
+void draw (GLFWwindow* window)
+{
+    cursorx = cursory = 0;
+#ifndef HEADLESS
+    glfwGetCursorPos(window, &cursorx, &cursory);
+#endif
+    glm::vec2 cursor = camera.toWorld(cursorx, cursory, LAYER_PLAYFIELD);
+    cursorx = cursor.x;
+    cursory = cursor.y;
+    runSystems();
 }
 
+#ifndef HEADLESS
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height)
@@ -1230,6 +3176,7 @@ GLFWwindow* initGLFW (int width, int height)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_DEPTH_BITS, 0);     // layers are painted in order, nothing reads depth
 
     window = glfwCreateWindow(width, height, "Brick Breaker - Pranav Goel", NULL, NULL);
 
@@ -1262,6 +3209,7 @@ GLFWwindow* initGLFW (int width, int height)
 
     return window;
 }
+#endif
 
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
@@ -1278,65 +3226,71 @@ void initGL (GLFWwindow* window, int width, int height)
     color Black = {0,0,0};
     // Create the models
     createLine (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-    createCircle ("circle1",WhiteShade,2.3,3.0,0.4,15,"m1");
+    createCircle ("circle1",WhiteShade,2.3,3.0,0.4,"m1");
     createRectangle ("star1",1.0,3.5,Yellow,Yellow,Yellow,Yellow, 0.30,0.30,0,0,"background");
     createRectangle ("star2",-1.0,3.5,Yellow,Yellow,Yellow,Yellow, 0.30,0.30,0,0,"background");
     createRectangle ("life",-3.8,3.40,Black,Black,Black,Black,0.20,0.20,0,0,"background");
-    createRectangle ("move1",-2.1,0.0,Yellow,Red,Red,Yellow,1.5,0.2,0,0,"moving");
-    createRectangle ("redbox",0.6,-3.5,Red,Red,Red,Red,1,1,1,0,"bottom");
-    createRectangle ("greenbox",-0.6,-3.5,Green,Green,Green,Green,1,1,1,0,"bottom");
-    createRectangle ("laserbox", -3.6,0,Blue,Red,Blue,Red,0.80,0.80,0,1,"laser");
-    createRectangle ("laserbox2",-3,0,Red,Blue,Red,Blue,0.40,0.40,0,1,"laser");
+    createRectangle ("move1",-2.1,0.0,Yellow,Red,Red,Yellow,1.5,0.2,0,0,"moving",MOVE1);
+    createRectangle ("redbox",0.6,-3.5,Red,Red,Red,Red,1,1,1,0,"bottom",REDBOX);
+    createRectangle ("greenbox",-0.6,-3.5,Green,Green,Green,Green,1,1,1,0,"bottom",GREENBOX);
+    createRectangle ("laserbox", -3.6,0,Blue,Red,Blue,Red,0.80,0.80,0,1,"laser",LASERBOX);
+    createRectangle ("laserbox2",-3,0,Red,Blue,Red,Blue,0.40,0.40,0,1,"laser",LASERBOX2);
     createRectangle ("mirror1",2.5,2.0,SkyBlue,SkyBlue,SkyBlue,SkyBlue,0.3,1.0,0,0,"mirror");
     createRectangle ("mirror2",2.5,-1.0,SkyBlue,SkyBlue,SkyBlue,SkyBlue,0.3,1.0,0,0,"mirror");
     float t1,t2;
-    t1 = boxes["laserbox2"].x;
-    t2 = boxes["laserbox2"].y;
-    
-    createRectangle ("top1",3.6,3.8,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("center1",3.6,3.3,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("bottom1",3.6,2.8,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("ul1",3.4,3.55,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("ur1",3.8,3.55,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("bl1",3.4,3.05,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("br1",3.8,3.05,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-
-    createRectangle ("top2",3.0,3.8,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("center2",3.0,3.3,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("bottom2",3.0,2.8,Blue,Blue,Blue,Blue,0.02,0.4,0,0,"score");
-    createRectangle ("ul2",2.8,3.55,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("ur2",3.2,3.55,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("bl2",2.8,3.05,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
-    createRectangle ("br2",3.2,3.05,Blue,Blue,Blue,Blue,0.5,0.02,0,0,"score");
+    t1 = entities[LASERBOX2].x;
+    t2 = entities[LASERBOX2].y;
     
-    createRectangle ("top3",-3.45,3.8,Blue,Blue,Blue,Blue,0.02,0.3,0,0,"score");
-    createRectangle ("center3",-3.45,3.40,Blue,Blue,Blue,Blue,0.02,0.3,0,0,"score");
-    createRectangle ("bottom3",-3.45,3.00,Blue,Blue,Blue,Blue,0.02,0.3,0,0,"score");
-    createRectangle ("ul3",-3.6,3.60,Blue,Blue,Blue,Blue,0.4,0.03,0,0,"score");
-    createRectangle ("ur3",-3.3,3.60,Blue,Blue,Blue,Blue,0.4,0.02,0,0,"score");
-    createRectangle ("bl3",-3.6,3.20,Blue,Blue,Blue,Blue,0.4,0.02,0,0,"score");
-    createRectangle ("br3",-3.3,3.20,Blue,Blue,Blue,Blue,0.4,0.02,0,0,"score");
-
     createRectangle ("speed1",-3.60,2.8,Yellow,Yellow,Yellow,Yellow,0.10,0.10,0,0,"speed");
     createRectangle ("speed2",-3.45,2.8,Yellow,Yellow,Yellow,Yellow,0.10,0.10,0,0,"speed");
     createRectangle ("speed3",-3.30,2.8,Yellow,Yellow,Yellow,Yellow,0.10,0.10,0,0,"speed");
+
+    bricks.init(maxbricks);
     
-    createRectangle ("laser",t1,t2,Blue,Blue,Blue,Blue,0.10,1.0,0,0,"laser");
+    createRectangle ("laser",t1,t2,Blue,Blue,Blue,Blue,0.10,1.0,0,0,"laser",LASER);
+    buildCannon();
 
     // Create and compile our GLSL program from the shaders
-    programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-    // Get a handle for our "MVP" uniform
-    Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+    programID = glresources.createProgram( "Sample_GL.vert", "Sample_GL.frag" );
+    // Attach its camera and sprite uniform blocks
+    bindUniformBlocks(programID);
 
 
     reshapeWindow (window, width, height);
 
+    // Eye - Location of camera. Don't change unless you are sure!!
+    glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+    // Target - Where is the camera looking at.  Don't change unless you are sure!!
+    glm::vec3 target (0, 0, 0);
+    // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+    glm::vec3 up (0, 1, 0);
+
+    // Compute Camera matrix (view)
+    // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
+    //  Don't change unless you are sure!!
+    // The view never changes, the camera only pans and zooms
+    Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+    camera.look(Matrices.view);
+
     // Background color of the scene
     glClearColor ((float)128/255, (float)128/255, (float)128/255, 0.0f); // R, G, B, A
-    glClearDepth (1.0f);
 
-    glEnable (GL_DEPTH_TEST);
-    glDepthFunc (GL_LEQUAL);
+    // no depth test: every sprite is at z=0 and layers are painted in order
+    glDisable (GL_DEPTH_TEST);
+
+    // round shapes fade out over their last pixel
+    glEnable (GL_BLEND);
+    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // after all the state it is drawn with has been set
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformalign);
+    stream.init(GL_ARRAY_BUFFER, streamsegment, 3, streammode);
+    camera.init();
+    camera.update();
+    brickbatch.init(bricks.limit());
+    digits.init();
+    sprites.init(maxbatchvertices);
+    statics.init(maxstaticvertices);
 
 /*    cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
     cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
@@ -1344,53 +3298,359 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;*/
 }
 
-string convert(int num)
+/* Spawn a brick of random colour above the screen. Nothing is spawned
+   while the pool is full */
+void create_brick()
+{
+    float x,y;
+    x = -2.0 + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(2.0+2.0)));
+    y = 3.1 + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(4.0-3.3)));
+    int temp1;
+    temp1 = rand() % 3;
+    bricks.spawn(x,y,brickspeed,temp1);
+}
+
+/* Create the fixed entities brick simulation depends on, without any
+   GL objects, so simulation benchmarks can run without a window */
+void initSim()
+{
+    Sprite prsprite = {};
+    SpriteInfo prinfo = {};
+    prsprite.x = -3;
+    prsprite.width = 1.0;
+    prsprite.height = 0.10;
+    entities.create(prsprite,prinfo,LASER);
+    entities.create(prsprite,prinfo,LASERBOX2);
+    prsprite.y = -3.5;
+    prsprite.x = 0.6;
+    entities.create(prsprite,prinfo,REDBOX);
+    prsprite.x = -0.6;
+    entities.create(prsprite,prinfo,GREENBOX);
+    buildCannon();
+    bricks.init(maxbricks);
+}
+
+/* Drop every reference to a GL object while the context is still current,
+   so everything is deleted deterministically before the window goes */
+void releaseGL()
+{
+    entities.clear();
+    scene.clear();
+    boxes.clear();
+    mirror.clear();
+    background.clear();
+    moving.clear();
+    speed.clear();
+    brickbatch.release();
+    digits.release();
+    line = VAORef();
+    sprites.release();
+    statics.release();
+    layercache.release();
+    camera.release();
+    stream.release();
+    geometry.clear();
+    glresources.deleteProgram(programID);
+}
+
+void printglstats()
 {
-    int len;
-    len=0;
-    int temp=num;
-    while(temp)
+    GLStats st = glresources.stats();
+    cout<<"GL objects: "<<st.vertexarrays<<" VAOs, "<<st.buffers<<" buffers, "<<st.programs<<" programs, ";
+    cout<<st.textures<<" textures, "<<st.framebuffers<<" framebuffers, ";
+    cout<<st.bufferbytes<<" bytes in buffers, "<<st.uploadedbytes<<" bytes uploaded"<<endl;
+    GeometryStats gs = geometry.stats();
+    cout<<"Geometry cache: "<<gs.meshes<<" meshes, "<<gs.hits<<" hits, "<<gs.bytessaved<<" bytes saved"<<endl;
+    StreamStats ss = stream.statistics();
+    cout<<"Stream: "<<ss.writes<<" writes, "<<ss.stalls<<" stalls, "<<ss.orphans<<" orphans"<<endl;
+    GLStateStats gst = glstate.stats();
+    cout<<"GL state: "<<gst.issued<<" changes issued, "<<gst.skipped<<" skipped"<<endl;
+    cout<<"Scene graph: "<<scene.recomputations()<<" world transforms worked out"<<endl;
+    cout<<"Culling: "<<totalcull.submitted<<" sprites submitted, "<<totalcull.culled<<" culled"<<endl;
+    cout<<"Layer cache:";
+    for(int l=0;l<LAYER_COUNT;l++)
     {
-        len++;
-        temp=temp/10;
+        if(!layerstatic[l])
+            continue;
+        LayerCacheStats ls = layercache.statistics(l);
+        cout<<" "<<layernames[l]<<" "<<ls.hits<<"/"<<ls.misses<<" hits/misses";
     }
-    char arr[10];
-    int  i=0,rem;
-    while(len)
+    cout<<endl;
+}
+
+/* Simulate 'seconds' of play at 60 fps without a window, spawning a brick
+   every 1.5 s like the main loop does, and print the simulation cost
+   for every ten minutes of game time. Input and rendering are switched
+   off, everything else runs through the normal pipeline */
+void soak(double seconds)
+{
+    initSim();
+
+    systems[INPUT_SYSTEM].enabled = 0;
+    systems[RENDER_SYSTEM].enabled = 0;
+    long frames = (long)(seconds*60);
+    long window = 10*60*60;
+    double elapsed = 0;
+    for(long f=1;f<=frames;f++)
     {
-        rem=num%10;
-        arr[len-1]=(char)('0'+rem);
-        num = num/10;
-        i++;
-        len=len-1;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        long mark = allocmark();
+        if(f%90==0)
+            create_brick();
+        runSystems();
+        allocassert(mark, "simulation frame");
+        elapsed += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        if(f%window==0)
+        {
+            cout<<"minute "<<f/3600<<": "<<elapsed/window<<" us/frame, "<<bricks.size()<<" live bricks"<<endl;
+            elapsed = 0;
+        }
     }
-    arr[i]='\0';
-    return arr;
 }
-void create_brick(int count)
+
+/* Measure brick update throughput on a pool of 'count' bricks that hang
+   in mid air, so none of them die during the run */
+void benchupdate(int count, int frames)
 {
-    int i,j;
-    color Black = {0,0,0};
-    color Red = {1,0,0};
-    color Green = {0,1,0};
-    for(i=count;i>count-1;i=i-1)
+    initSim();
+    bricks.init(count);
+    for(int i=0;i<count;i++)
+        create_brick();
+    for(int k=0;k<BRICK_KINDS;k++)
+    {
+        BrickGroup& g = bricks.group[k];
+        for(size_t i=0;i<g.size();i++)
+        {
+            g.yspeed[i] = 0;
+            g.y[i] = -2.0 + 5.0*i/g.size();
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int f=0;f<frames;f++)
+    {
+        moveBricks();
+        collideBricks();
+    }
+    double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    cout<<count<<" bricks x "<<frames<<" frames: "<<(double)count*frames/elapsed<<" bricks/us"<<endl;
+}
+
+/* Show the frame: swap the window, or just finish it when headless */
+void present(GLFWwindow* window)
+{
+#ifdef HEADLESS
+    glFinish();
+#else
+    glfwSwapBuffers(window);
+#endif
+}
+
+/* Render 'frames' frames with 10 to 100000 stationary bricks on screen
+   and print the average frame time for each count */
+void benchbricks(GLFWwindow* window, int frames)
+{
+    for(int count=10;count<=100000;count*=10)
+    {
+        for(int k=0;k<BRICK_KINDS;k++)
+            bricks.group[k] = BrickGroup();
+        bricks.init(count);
+        for(int i=0;i<count;i++)
+            bricks.spawn(-3.9 + 7.8*(i%300)/300, -3.9 + 7.8*(i/300%300)/300, 0, i%BRICK_KINDS);
+        brickbatch.release();
+        stream.release();
+        stream.init(GL_ARRAY_BUFFER, streamsegment + bricks.limit()*sizeof(BrickInstance), 3, streammode);
+        brickbatch.init(bricks.limit());
+
+        renderSystem();
+        glFinish();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int f=0;f<frames;f++)
+        {
+            renderSystem();
+            present(window);
+        }
+        glFinish();
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout<<count<<" bricks: "<<elapsed/frames<<" ms/frame"<<endl;
+    }
+}
+
+/* Stream 'bytes' per frame for 'frames' frames with every StreamMode, and
+   have the GPU read each write with a one point draw so the CPU and GPU
+   really share the buffer. Prints the average time per frame */
+void benchstream(GLFWwindow* window, int frames)
+{
+    const char* names[] = {"ring", "orphan", "subdata"};
+    GLuint vao = glresources.createVertexArray();
+    glstate.bindVertexArray (vao);
+    glEnableVertexAttribArray(0);
+    glstate.useProgram (programID);
+    // the sprite program reads the Sprites block, so give it a zeroed one
+    vector<SpritePlacement> zeroes(maxsprites);
+    memset(&zeroes[0], 0, zeroes.size()*sizeof(SpritePlacement));
+    GLuint block = glresources.createBuffer(GL_UNIFORM_BUFFER, zeroes.size()*sizeof(SpritePlacement), &zeroes[0], GL_STATIC_DRAW);
+    glstate.bindUniformRange(SPRITE_BLOCK, block, 0, zeroes.size()*sizeof(SpritePlacement));
+    for(size_t bytes=4*1024;bytes<=1024*1024;bytes*=16)
     {
-        string temp = convert(i);
-        float x,y;
-        x = -2.0 + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(2.0+2.0)));
-        y = 3.1 + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(4.0-3.3)));
-        int temp1;
-        temp1 = rand() % 3;
-        if(temp1==0)
-            createRectangle(temp,x,y,Black,Black,Black,Black,0.20,0.20,0,0,"blackbrick");
-        else if(temp1==1)
-            createRectangle(temp,x,y,Red,Red,Red,Red,0.20,0.20,0,0,"redbrick");
-        else if(temp1==2)
-            createRectangle(temp,x,y,Green,Green,Green,Green,0.20,0.20,0,0,"greenbrick");
+        vector<char> data(bytes, 0);
+        for(int m=STREAM_RING;m<=STREAM_SUBDATA;m++)
+        {
+            StreamBuffer sb;
+            sb.init(GL_ARRAY_BUFFER, 4*bytes, 3, StreamMode(m));
+            chrono::steady_clock::time_point start;
+            for(int f=-10;f<frames;f++)     // ten frames to warm up first
+            {
+                if(f==0)
+                {
+                    glFinish();
+                    start = chrono::steady_clock::now();
+                }
+                for(int w=0;w<4;w++)    // several flushes per frame, like the sprite batch
+                {
+                    GLintptr at = sb.write(&data[0], bytes);
+                    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)at);
+                    glDrawArrays(GL_POINTS, 0, 1);
+                }
+                sb.endFrame();
+                present(window);
+            }
+            glFinish();
+            double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            StreamStats st = sb.statistics();
+            cout<<names[m]<<" "<<bytes/1024<<" KB x4: "<<elapsed/frames<<" us/frame, "<<st.stalls<<" stalls, "<<st.orphans<<" orphans"<<endl;
+            sb.release();
+        }
+    }
+    glresources.deleteBuffer(block);
+    glresources.deleteVertexArray(vao);
+}
+
+#ifdef HEADLESS
+/* Offscreen backend for machines without a display: a surfaceless EGL
+   context (llvmpipe when there is no GPU) drawing into a framebuffer
+   object instead of a window */
+typedef struct Headless
+{
+    EGLDisplay display;
+    EGLContext context;
+    GLuint framebuffer;
+    GLuint colour;
+} Headless;
+
+Headless headless;
+
+bool initHeadless(int width, int height)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    headless.display = EGL_NO_DISPLAY;
+    if(getPlatformDisplay)
+        headless.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if(headless.display==EGL_NO_DISPLAY)
+        headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(headless.display==EGL_NO_DISPLAY || !eglInitialize(headless.display, NULL, NULL))
+        return false;
+
+    // the same 3.3 core context the window gets, with no surface at all
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    headless.context = eglCreateContext(headless.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+    if(headless.context==EGL_NO_CONTEXT || !eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context))
+        return false;
+    gladLoadGLLoader((GLADloadproc) eglGetProcAddress);
+
+    // everything is drawn into this instead of a window, colour only
+    glGenRenderbuffers(1, &headless.colour);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless.colour);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &headless.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless.colour);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER)==GL_FRAMEBUFFER_COMPLETE;
+}
+
+void releaseHeadless()
+{
+    glDeleteFramebuffers(1, &headless.framebuffer);
+    glDeleteRenderbuffers(1, &headless.colour);
+    eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(headless.display, headless.context);
+    eglTerminate(headless.display);
+}
 
+/* Play 'frames' frames of the game offscreen with the clock moving 1/60 s
+   a frame, a brick every 1.5 s like the main loop, and print how long
+   the frames took after warm-up. Each frame is finished before it is
+   timed, so the times include the rendering itself. Nobody plays, so
+   lives are given back when they run out rather than ending the run.
+   Returns false if no frame was left to time after warm-up */
+bool runheadless(int frames)
+{
+    if(frames<=warmupframes)
+    {
+        cerr<<"--frames must be more than the "<<warmupframes<<" warm-up frames"<<endl;
+        return false;
+    }
+    vector<double> ms;
+    ms.reserve(frames);
+    current_time = old_time = 0;
+    int lives = penalty, gameovers = 0;
+    for(int f=1;f<=frames;f++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        long mark = allocmark();
+        current_time = f/60.0;
+        draw(NULL);
+        old_time = current_time;
+        if(f%90==0)
+            create_brick();
+        if(penalty<=0)
+        {
+            penalty = lives;
+            gameovers++;
+        }
+        glFinish();
+        if(warmedup(f))
+        {
+            allocassert(mark, "headless frame");
+            ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        else
+            ms.clear();     // warm-up starts over at the first bricks, drop the empty scene
+    }
+    if(gameovers>0)
+        cout<<"Ran out of lives "<<gameovers<<" times"<<endl;
+    if(ms.empty())
+    {
+        cerr<<"All "<<frames<<" frames were warm-up, none measured"<<endl;
+        return false;
     }
 
+    double total = 0;
+    for(size_t i=0;i<ms.size();i++)
+        total += ms[i];
+    sort(ms.begin(), ms.end());
+    cout<<"Headless: "<<ms.size()<<" frames after "<<frames-ms.size()<<" warm-up, ms/frame: mean "<<total/ms.size();
+    cout<<", median "<<ms[ms.size()/2]<<", 95% "<<ms[ms.size()*95/100]<<", 99% "<<ms[ms.size()*99/100];
+    cout<<", best "<<ms.front()<<", worst "<<ms.back()<<endl;
+    return true;
+}
+#endif
 
+/* Destroy the window, or the offscreen context of a headless build */
+void closeWindow(GLFWwindow* window)
+{
+#ifdef HEADLESS
+    releaseHeadless();
+#else
+    glfwDestroyWindow(window);
+    glfwTerminate();
+#endif
 }
 
 int main (int argc, char** argv)
@@ -1398,14 +3658,71 @@ int main (int argc, char** argv)
     int width = 600;
     int height = 600;
 
+    if(argc>1 && string(argv[1])=="--soak")
+    {
+        soak(3600);
+        exit(EXIT_SUCCESS);
+    }
+    if(argc>1 && string(argv[1])=="--bench-update")
+    {
+        benchupdate(10000, 1000);
+        exit(EXIT_SUCCESS);
+    }
+
+#ifdef HEADLESS
+    int frames = 1000;
+#endif
+    for(int a=1;a<argc;a++)
+    {
+        if(string(argv[a])=="--orphan")   // for drivers where mapping buffers is slow
+            streammode = STREAM_ORPHAN;
+        if(string(argv[a])=="--no-layer-cache")
+            layercaching = 0;
+#ifdef HEADLESS
+        if(string(argv[a])=="--frames" && a+1<argc)
+            frames = atoi(argv[++a]);
+#endif
+    }
+
+#ifdef HEADLESS
+    GLFWwindow* window = NULL;
+    if(!initHeadless(width, height))
+    {
+        cerr<<"No EGL display to render to"<<endl;
+        exit(EXIT_FAILURE);
+    }
+#else
     GLFWwindow* window = initGLFW(width, height);
+#endif
 
     initGL (window, width, height);
 
+    if(argc>1 && string(argv[1])=="--bench-stream")
+    {
+        benchstream(window, 200);
+        releaseGL();
+        closeWindow(window);
+        exit(EXIT_SUCCESS);
+    }
+    if(argc>1 && string(argv[1])=="--bench-bricks")
+    {
+        benchbricks(window, 100);
+        releaseGL();
+        closeWindow(window);
+        exit(EXIT_SUCCESS);
+    }
+
+#ifdef HEADLESS
+    bool measured = runheadless(frames);
+    releaseGL();
+    printglstats();
+    closeWindow(window);
+    exit(measured ? EXIT_SUCCESS : EXIT_FAILURE);
+#else
     double last_update_time = glfwGetTime();
     double brick_time=last_update_time;
-    int count=3;
     int flag=0;
+    long frame=0;
     score=0;
 
     /* Draw in loop */
@@ -1416,14 +3733,21 @@ int main (int argc, char** argv)
         if(penalty>0)
         {
             current_time = glfwGetTime();
+            frame++;
 
+            // after warm-up a frame must not allocate (checked with -DALLOC_CHECK)
+            long mark = allocmark();
             draw(window);
+            if(warmedup(frame))
+                allocassert(mark, "draw()");
             old_time = current_time;
             current_time = glfwGetTime();
             if(current_time-brick_time>1.5)
             {
-                count+=3;
-                create_brick(count);
+                mark = allocmark();
+                create_brick();
+                if(warmedup(frame))
+                    allocassert(mark, "create_brick()");
                 brick_time=glfwGetTime();
             }
 
@@ -1452,7 +3776,10 @@ int main (int argc, char** argv)
 
     }
 
-    glfwTerminate();
+    releaseGL();
+    printglstats();
+    closeWindow(window);
     //    return 0;
     exit(EXIT_SUCCESS);
+#endif
 }